@@ -3,7 +3,63 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buckets of the queue histograms: 0, 1, 2-3, 4-7, 8-15, 16+. */
+#define HIST_BUCKETS 6
+
+/* Most sectors merged into one transfer by a queue dispatcher,
+   and the pages of the bounce buffer that holds them. */
+#define MERGE_PAGES 8
+#define MERGE_MAX (MERGE_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A queue of requests to the block devices behind one controller,
+   served by a dispatcher thread in C-LOOK order: ascending by
+   device and sector from where the last transfer ended, wrapping
+   around to the lowest once nothing lies ahead.  Adjacent
+   requests in the same direction go out as one transfer. */
+struct block_queue
+  {
+    struct list_elem list_elem;         /* Element in all_queues. */
+    char name[16];                      /* Name, for statistics. */
+
+    struct lock lock;                   /* Protects the fields below. */
+    struct condition nonempty;          /* Signaled on submission. */
+    struct list requests;               /* Sorted by device, sector. */
+    int depth;                          /* Requests queued or in flight. */
+    struct block *head_block;           /* Device and sector just past */
+    block_sector_t head_sector;         /* the last transfer. */
+
+    uint8_t *bounce;                    /* Holds merged transfers. */
+
+    /* Statistics, updated by submitters and the dispatcher. */
+    unsigned long long depth_hist[HIST_BUCKETS];   /* At submission. */
+    unsigned long long latency_hist[HIST_BUCKETS]; /* In timer ticks. */
+    unsigned long long merge_cnt;       /* Requests merged into another's
+                                           transfer. */
+  };
+
+/* A request waiting in a block queue.  Lives on the submitter's
+   stack until DONE is up'd. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in queue or batch. */
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* Kernel buffer, CNT sectors. */
+    bool write;                         /* Direction. */
+    int64_t submitted;                  /* timer_ticks() at submission. */
+    struct semaphore done;              /* Up'd when transferred. */
+  };
+
+/* List of all block queues. */
+static struct list all_queues = LIST_INITIALIZER (all_queues);
 
 /* A block device. */
 struct block
@@ -16,9 +72,12 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    struct block_queue *queue;          /* Request queue, or null. */
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long cache_hit_cnt;   /* Buffer cache hits. */
+    unsigned long long cache_miss_cnt;  /* Buffer cache misses. */
   };
 
 /* List of all block devices. */
@@ -28,6 +87,11 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void submit (struct block *, block_sector_t, size_t cnt,
+                    void *buffer, bool write);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
+static thread_func dispatcher NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +184,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +195,281 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses the driver's multi-sector transfer if it has one.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  submit (block, sector, cnt, buffer, false);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses the driver's multi-sector transfer if it has one.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  if (cnt == 0)
+    return;
   check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit (block, sector, cnt, (void *) buffer, true);
+  block->write_cnt += cnt;
+}
+
+/* Returns the histogram bucket for VALUE. */
+static int
+hist_bucket (int64_t value)
+{
+  int bucket = 0;
+
+  while (value > 0 && bucket < HIST_BUCKETS - 1)
+    {
+      value >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Returns true if request A sorts before request B, by device
+   and then by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  if (a->block != b->block)
+    return (uintptr_t) a->block < (uintptr_t) b->block;
+  return a->sector < b->sector;
+}
+
+/* Transfers CNT sectors between BLOCK at SECTOR and BUFFER and
+   waits for the transfer to finish.  Goes through BLOCK's queue
+   if it has one.  User buffers bypass the queue and are
+   transferred directly, since the dispatcher thread does not run
+   in the submitter's address space. */
+static void
+submit (struct block *block, block_sector_t sector, size_t cnt,
+        void *buffer, bool write)
+{
+  struct block_queue *q = block->queue;
+  struct block_request r;
+
+  if (q == NULL || !is_kernel_vaddr (buffer))
+    {
+      transfer (block, sector, cnt, buffer, write);
+      return;
+    }
+
+  r.block = block;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.submitted = timer_ticks ();
+  sema_init (&r.done, 0);
+
+  lock_acquire (&q->lock);
+  list_insert_ordered (&q->requests, &r.elem, request_less, NULL);
+  q->depth++;
+  q->depth_hist[hist_bucket (q->depth)]++;
+  cond_signal (&q->nonempty, &q->lock);
+  lock_release (&q->lock);
+
+  sema_down (&r.done);
+}
+
+/* Creates a request queue named NAME, with its own dispatcher
+   thread, for the block devices behind one controller.  Devices
+   are attached to it with block_set_queue(). */
+struct block_queue *
+block_queue_create (const char *name)
+{
+  struct block_queue *q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block queue");
+
+  memset (q, 0, sizeof *q);
+  strlcpy (q->name, name, sizeof q->name);
+  lock_init (&q->lock);
+  cond_init (&q->nonempty);
+  list_init (&q->requests);
+  q->bounce = palloc_get_multiple (PAL_ASSERT, MERGE_PAGES);
+  list_push_back (&all_queues, &q->list_elem);
+
+  thread_create (name, PRI_MAX, dispatcher, q);
+  return q;
+}
+
+/* Routes all transfers on BLOCK through QUEUE. */
+void
+block_set_queue (struct block *block, struct block_queue *queue)
+{
+  block->queue = queue;
+}
+
+/* Serves queue Q_ forever.  Each round picks the next request in
+   C-LOOK order, takes along every following request that
+   continues it on disk in the same direction, and transfers them
+   all at once, through Q's bounce buffer if there is more than
+   one. */
+static void
+dispatcher (void *q_)
+{
+  struct block_queue *q = q_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct list_elem *e;
+      struct block_request *first = NULL;
+      block_sector_t end;
+      size_t cnt;
+
+      lock_acquire (&q->lock);
+      while (list_empty (&q->requests))
+        cond_wait (&q->nonempty, &q->lock);
+
+      for (e = list_begin (&q->requests); e != list_end (&q->requests);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if ((uintptr_t) r->block > (uintptr_t) q->head_block
+              || (r->block == q->head_block && r->sector >= q->head_sector))
+            {
+              first = r;
+              break;
+            }
+        }
+      if (first == NULL)
+        first = list_entry (list_front (&q->requests),
+                            struct block_request, elem);
+
+      list_init (&batch);
+      end = first->sector + first->cnt;
+      cnt = first->cnt;
+      e = list_next (&first->elem);
+      list_remove (&first->elem);
+      list_push_back (&batch, &first->elem);
+      while (e != list_end (&q->requests))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (r->block != first->block || r->write != first->write
+              || r->sector != end || cnt + r->cnt > MERGE_MAX)
+            break;
+          e = list_next (e);
+          list_remove (&r->elem);
+          list_push_back (&batch, &r->elem);
+          end += r->cnt;
+          cnt += r->cnt;
+          q->merge_cnt++;
+        }
+      q->head_block = first->block;
+      q->head_sector = end;
+      lock_release (&q->lock);
+
+      if (cnt == first->cnt)
+        transfer (first->block, first->sector, cnt, first->buffer,
+                  first->write);
+      else
+        {
+          uint8_t *p = q->bounce;
+
+          if (first->write)
+            for (e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          transfer (first->block, first->sector, cnt, q->bounce,
+                    first->write);
+          if (!first->write)
+            for (e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* A request may vanish as soon as it is up'd. */
+      lock_acquire (&q->lock);
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          q->latency_hist[hist_bucket (timer_elapsed (r->submitted))]++;
+          q->depth--;
+          sema_up (&r->done);
+        }
+      lock_release (&q->lock);
+    }
+}
+
+/* Has BLOCK's driver transfer CNT sectors between SECTOR and
+   BUFFER, with its multi-sector operation if it has one. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Counts one buffer cache lookup on BLOCK, a hit if HIT is
+   true and a miss otherwise.  Called by whichever cache sits on
+   top of BLOCK, so that block_print_stats() can report it. */
+void
+block_cache_stat (struct block *block, bool hit)
+{
+  if (hit)
+    block->cache_hit_cnt++;
+  else
+    block->cache_miss_cnt++;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -164,6 +497,7 @@ block_type (struct block *block)
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -174,8 +508,28 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->cache_hit_cnt + block->cache_miss_cnt > 0)
+            printf ("%s (%s): %llu cache hits, %llu cache misses\n",
+                    block->name, block_type_name (block->type),
+                    block->cache_hit_cnt, block->cache_miss_cnt);
         }
     }
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      static const char *labels[HIST_BUCKETS] =
+        { "0", "1", "2-3", "4-7", "8-15", "16+" };
+      struct block_queue *q = list_entry (e, struct block_queue, list_elem);
+
+      printf ("%s queue: %llu merged; depth", q->name, q->merge_cnt);
+      for (i = 1; i < HIST_BUCKETS; i++)
+        printf (" %s:%llu", labels[i], q->depth_hist[i]);
+      printf ("; latency (ticks)");
+      for (i = 0; i < HIST_BUCKETS; i++)
+        printf (" %s:%llu", labels[i], q->latency_hist[i]);
+      printf ("\n");
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,8 +552,11 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  block->queue = NULL;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->cache_hit_cnt = 0;
+  block->cache_miss_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -33,7 +34,9 @@
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +52,51 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one READ/WRITE SECTOR command can transfer; a
+   count register of 0 means 256. */
+#define MAX_SECTORS_PER_CMD 256
+
+/* PCI configuration space access ports, and the registers of a
+   PCI IDE controller that we look at.  See [PCI] and [BMIDE]. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_REG_ID 0x00                 /* Device ID, vendor ID. */
+#define PCI_REG_COMMAND 0x04            /* Command register (low word). */
+#define PCI_REG_CLASS 0x08              /* Class, subclass, prog-if. */
+#define PCI_REG_BAR4 0x20               /* Bus master I/O base. */
+#define PCI_CMD_IO 0x01                 /* Respond to I/O accesses. */
+#define PCI_CMD_MASTER 0x04             /* May act as bus master. */
+#define PCI_PROGIF_MASTER 0x80          /* IDE controller can bus master. */
+#define PCI_PROGIF_NATIVE 0x05          /* Either channel in native mode. */
+
+/* Bus master IDE port addresses, relative to a channel's 8-byte
+   block of bus master registers. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)
+
+/* Bus master command and status register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_TO_MEMORY 0x08   /* Direction: 1=disk to memory. */
+#define BM_STA_ERR 0x02         /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Device interrupted (write 1 to clear). */
+
+/* Physical region descriptor: one physically contiguous piece of
+   a DMA buffer.  A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000
+
+/* Regions in a PRD table.  A 256-sector transfer is 128 kB, which
+   spans at most 3 of the 64 kB windows regions may not cross. */
+#define PRD_CNT 4
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +105,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Does the disk support DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +121,15 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master registers, 0 if no DMA. */
+    struct prd prdt[PRD_CNT]    /* PRD table; aligned so it can't */
+      __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+                                /* cross a 64 kB boundary. */
+    unsigned long long dma_cnt; /* Sectors transferred by DMA. */
+    unsigned long long pio_cnt; /* Sectors transferred by PIO. */
+
+    struct block_queue *queue;  /* Request queue for both devices. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,11 +139,15 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+/* Use bus master DMA when the controller supports it?  Cleared by
+   the kernel's -pio option. */
+bool ide_use_dma = true;
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,12 +157,18 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static uint16_t find_bus_master (void);
+static bool dma_usable (const struct ata_disk *, const void *buffer);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool to_memory);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = ide_use_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +194,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->dma_cnt = c->pio_cnt = 0;
+      c->queue = NULL;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +207,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -281,13 +353,16 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity, and check for DMA support (word 49,
+     bit 8).
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -303,9 +378,13 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
-  /* Register. */
+  /* Register.  The devices on a channel share one request
+     queue, since they can only be accessed one at a time. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  if (c->queue == NULL)
+    c->queue = block_queue_create (c->name);
+  block_set_queue (block, c->queue);
   partition_scan (block);
 }
 
@@ -337,63 +416,142 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Issues
+   one command per MAX_SECTORS_PER_CMD sectors, transferred by DMA
+   if possible and otherwise by PIO, where the disk raises an
+   interrupt as each sector becomes ready.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      size_t i;
+
+      if (dma_usable (d, buffer))
+        {
+          dma_transfer (d, sec_no, n, buffer, true);
+          buffer += n * BLOCK_SECTOR_SIZE;
+        }
+      else
+        {
+          select_sectors (d, sec_no, n);
+          issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, buffer);
+              buffer += BLOCK_SECTOR_SIZE;
+            }
+          c->pio_cnt += n;
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Issues
+   one command per MAX_SECTORS_PER_CMD sectors, transferred by DMA
+   if possible and otherwise by PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      size_t i;
+
+      if (dma_usable (d, buffer))
+        {
+          dma_transfer (d, sec_no, n, (void *) buffer, false);
+          buffer += n * BLOCK_SECTOR_SIZE;
+        }
+      else
+        {
+          select_sectors (d, sec_no, n);
+          issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, buffer);
+              buffer += BLOCK_SECTOR_SIZE;
+              sema_down (&c->completion_wait);
+            }
+          c->pio_cnt += n;
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +560,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Used for DMA commands as well. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -430,6 +588,139 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Prints how many sectors each channel with disks moved by DMA
+   and by PIO. */
+void
+ide_print_stats (void)
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (c->dma_cnt + c->pio_cnt > 0)
+      printf ("%s: %llu sectors by DMA, %llu by PIO\n",
+              c->name, c->dma_cnt, c->pio_cnt);
+}
+
+/* Bus master DMA. */
+
+/* Reads the 32-bit register at offset REG of the configuration
+   space of PCI function FN of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int fn, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG of the
+   configuration space of PCI function FN of device DEV on
+   bus 0. */
+static void
+pci_write_config (int dev, int fn, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that drives the two
+   legacy channels and can act as a bus master, such as the PIIX
+   that QEMU emulates.  Enables bus mastering on it and returns
+   the I/O base of its bus master registers, or 0 if there is no
+   such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, fn;
+
+  for (dev = 0; dev < 32; dev++)
+    for (fn = 0; fn < 8; fn++)
+      {
+        uint32_t class, bar4, command;
+
+        if ((pci_read_config (dev, fn, PCI_REG_ID) & 0xffff) == 0xffff)
+          continue;
+        class = pci_read_config (dev, fn, PCI_REG_CLASS);
+        if (class >> 16 != 0x0101
+            || !(class & (PCI_PROGIF_MASTER << 8))
+            || (class & (PCI_PROGIF_NATIVE << 8)))
+          continue;
+        bar4 = pci_read_config (dev, fn, PCI_REG_BAR4);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        command = pci_read_config (dev, fn, PCI_REG_COMMAND);
+        pci_write_config (dev, fn, PCI_REG_COMMAND,
+                          (command & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Returns true if a transfer between disk D and BUFFER can be
+   done by DMA.  The controller needs physical addresses, which we
+   only know for kernel virtual addresses; user buffers go by PIO. */
+static bool
+dma_usable (const struct ata_disk *d, const void *buffer)
+{
+  return d->dma && is_kernel_vaddr (buffer);
+}
+
+/* Transfers CNT sectors, at most MAX_SECTORS_PER_CMD, between
+   disk D starting at SEC_NO and BUFFER, a kernel virtual address,
+   by bus master DMA.  TO_MEMORY is true to read from the disk.
+   The calling thread sleeps on the channel's completion_wait for
+   the whole transfer, so the CPU is free to run other threads.
+   Caller must hold the channel lock. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool to_memory)
+{
+  struct channel *c = d->channel;
+  uintptr_t addr = vtop (buffer);
+  size_t left = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t direction = to_memory ? BM_CMD_TO_MEMORY : 0;
+  uint8_t bm_status;
+  int i;
+
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
+
+  /* Kernel virtual memory maps physical memory linearly, so the
+     buffer is physically contiguous; split it at 64 kB
+     boundaries. */
+  for (i = 0; left > 0; i++)
+    {
+      size_t size = 0x10000 - (addr & 0xffff);
+      if (size > left)
+        size = left;
+      ASSERT (i < PRD_CNT);
+      c->prdt[i].addr = addr;
+      c->prdt[i].size = size & 0xffff;
+      c->prdt[i].flags = 0;
+      addr += size;
+      left -= size;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, to_memory ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  if ((bm_status & BM_STA_ERR)
+      || (inb (reg_alt_status (c)) & (STA_ERR | STA_DF)))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu, d->name,
+           to_memory ? "read" : "write", sec_no);
+  c->dma_cnt += cnt;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
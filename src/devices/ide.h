@@ -1,6 +1,11 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+extern bool ide_use_dma;
+
 void ide_init (void);
+void ide_print_stats (void);
 
 #endif /* devices/ide.h */
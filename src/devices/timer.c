@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include <list.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
@@ -24,11 +25,68 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Cost of timer_interrupt(), which runs with interrupts off. */
+static struct timer_intr_stats intr_stats;
+
+/* Time-stamp counter at timer_init(), and when the idle thread
+   last halted (0 if it isn't halted). */
+static uint64_t boot_tsc;
+static uint64_t idle_tsc;
+
+/* Time-stamp counter cycles per second, measured against the PIT
+   by timer_calibrate(), 0 before that. */
+static uint64_t tsc_hz;
+
+#define NSEC_PER_SEC 1000000000
+#define TSC_CALIBRATE_TICKS 5
+
+/* Threads in a sleep shorter than a tick.  Channel 0 is switched
+   from its periodic tick to a countdown to the first deadline, when
+   that comes before the next tick, and then to a countdown to the
+   rest of the tick, after which periodic ticks resume.  A local
+   APIC timer would spare the tick, but there is no local APIC
+   support here. */
+struct hrsleeper
+  {
+    struct list_elem elem;      /* Element in hrsleepers. */
+    int64_t deadline;           /* timer_nanoseconds() to wake up at. */
+    struct thread *thread;      /* The sleeping thread. */
+  };
+
+/* Sleeping threads, in order of deadline. */
+static struct list hrsleepers;
+
+/* Shorter sleeps busy-wait, since the interrupt and the two
+   context switches would cost about as much. */
+#define HRSLEEP_MIN_NS 20000
+
+static bool hr_armed;           /* Channel 0 counting to a deadline? */
+static int hr_tick_left;        /* PIT cycles from its end to the tick. */
+
+/* Dynamic ticks.  While the idle thread is halted, the periodic
+   tick is replaced by a single PIT countdown that ends at the next
+   tick that has work to do, so an idle machine takes one interrupt
+   every few ticks instead of one per tick.  The PIT's 16-bit
+   counter limits a countdown to TICKLESS_MAX_TICKS ticks. */
+bool timer_tickless;
+
+#define PIT_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define TICKLESS_MAX_TICKS (UINT16_MAX / PIT_TICK)
+
+static bool countdown_armed;    /* Periodic tick stopped? */
+static int64_t countdown_base;  /* Value of ticks when it stopped. */
+static int countdown_ticks;     /* Ticks the countdown lasts. */
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static inline uint64_t rdtsc (void);
+static int64_t countdown_stop (bool expired_in_handler);
+static void hr_sleep (int64_t ns);
+static void hr_wakeup (void);
+static void hr_program (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -37,6 +95,8 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  list_init (&hrsleepers);
+  boot_tsc = rdtsc ();
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -44,6 +104,8 @@ void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t tsc_start;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -63,6 +125,16 @@ timer_calibrate (void)
     if (!too_many_loops (loops_per_tick | test_bit))
       loops_per_tick |= test_bit;
 
+  /* Count time-stamp counter cycles over a few whole ticks. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  tsc_start = rdtsc ();
+  start = ticks;
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier ();
+  tsc_hz = (rdtsc () - tsc_start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
 }
 
@@ -85,6 +157,23 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted, read
+   from the time-stamp counter once timer_calibrate() has measured
+   its rate, and at tick resolution before that. */
+int64_t
+timer_nanoseconds (void)
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (NSEC_PER_SEC / TIMER_FREQ);
+
+  /* Split the conversion so that the products can't overflow. */
+  cycles = rdtsc () - boot_tsc;
+  return (cycles / tsc_hz * NSEC_PER_SEC
+          + cycles % tsc_hz * NSEC_PER_SEC / tsc_hz);
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -159,29 +248,279 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Copies the timer interrupt handler statistics into STATS. */
+void
+timer_get_intr_stats (struct timer_intr_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = intr_stats;
+  intr_set_level (old_level);
+}
+
+/* Clears the timer interrupt handler statistics, so that a test
+   can measure just its own workload. */
+void
+timer_reset_intr_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  intr_stats.ticks = 0;
+  intr_stats.total_cycles = 0;
+  intr_stats.max_cycles = 0;
+  intr_stats.tickless_ticks = 0;
+  intr_stats.idle_cycles = 0;
+  intr_set_level (old_level);
+}
+
+/* Called by the idle thread, with interrupts off, right before it
+   halts.  In tickless mode, stops the periodic tick until the next
+   sleeper is due, or until the next load average update under the
+   MLFQS, whichever comes first, if that's more than a tick away. */
+void
+timer_idle_enter (void)
+{
+  int64_t limit;
+  int64_t n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idle_tsc = rdtsc ();
+  if (!timer_tickless || countdown_armed
+      || hr_armed || !list_empty (&hrsleepers))
+    return;
+
+  limit = ticks + TICKLESS_MAX_TICKS;
+  if (thread_mlfqs && limit > ROUND_UP (ticks + 1, TIMER_FREQ))
+    limit = ROUND_UP (ticks + 1, TIMER_FREQ);
+  n = thread_next_wakeup (limit) - ticks;
+  if (n < 2)
+    return;
+
+  countdown_armed = true;
+  countdown_base = ticks;
+  countdown_ticks = n;
+  pit_start_countdown (0, n * PIT_TICK);
+}
+
+/* Called by the scheduler, with interrupts off, whenever the idle
+   thread stops running.  Accounts for the time spent halted and
+   restarts the periodic tick if it was stopped. */
+void
+timer_idle_exit (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_tsc != 0)
+    {
+      intr_stats.idle_cycles += rdtsc () - idle_tsc;
+      idle_tsc = 0;
+    }
+  if (countdown_armed)
+    ticks = countdown_stop (false);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  struct timer_intr_stats stats;
+
+  timer_get_intr_stats (&stats);
+  printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts\n",
+          timer_ticks (), stats.ticks);
+  if (stats.ticks > 0)
+    printf ("Timer: interrupt handler %"PRIu64" cycles/tick avg, "
+            "%"PRIu64" max\n",
+            stats.total_cycles / stats.ticks, stats.max_cycles);
+  printf ("Timer: idle %"PRIu64"%% of the time, "
+          "%"PRId64" ticks without an interrupt\n",
+          stats.idle_cycles * 100 / (rdtsc () - boot_tsc + 1),
+          stats.tickless_ticks);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
+  uint64_t start = rdtsc ();
+  uint64_t cycles;
+  int64_t prev = ticks;
+  bool expired = false;
+
+  /* A tick that was already pending when a countdown started
+     arrives before the countdown ends. */
+  if (countdown_armed || hr_armed)
+    pit_read_counter (0, &expired);
+  if (countdown_armed && expired)
+    ticks = countdown_stop (true);
+  else if (hr_armed && expired && hr_tick_left == 0)
+    {
+      /* Counted down the rest of the tick: back to periodic. */
+      hr_armed = false;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      ticks++;
+    }
+  else if (!hr_armed || !expired)
+    ticks++;
+
+  hr_wakeup ();
+  hr_program ();
+  if (ticks == prev)
+    goto done;
+
+  /* After a countdown several ticks may have passed at once, but
+     the idle thread was the only one running during all of them. */
   if (thread_mlfqs) {
     thread_recent_cpu_tick ();
 
-    if (ticks % TIMER_FREQ == 0) {
+    if (ticks / TIMER_FREQ != prev / TIMER_FREQ) {
       thread_set_load_avg ();
-      thread_update_all_recent_cpu ();
+      thread_decay_recent_cpu ();
     }
 
-    if (ticks % 4 == 0) thread_update_all_priorities ();
+    if (ticks / 4 != prev / 4) thread_update_priority ();
+    thread_refresh_priorities ();
   }
+  thread_wakeup_sleepers (ticks);
   thread_tick ();
+
+ done:
+  cycles = rdtsc () - start;
+  intr_stats.ticks++;
+  intr_stats.total_cycles += cycles;
+  if (cycles > intr_stats.max_cycles)
+    intr_stats.max_cycles = cycles;
+}
+
+/* Stops the countdown started by timer_idle_enter() and restarts
+   the periodic tick.  Returns the tick count reached.  If the
+   countdown has run out but its interrupt hasn't been handled yet
+   (EXPIRED_IN_HANDLER false), the last tick is left for that
+   interrupt to count. */
+static int64_t
+countdown_stop (bool expired_in_handler)
+{
+  bool expired;
+  uint16_t left = pit_read_counter (0, &expired);
+  int64_t elapsed = countdown_ticks;
+
+  ASSERT (countdown_armed);
+
+  if (!expired)
+    elapsed = ((int64_t) countdown_ticks * PIT_TICK - left + PIT_TICK / 2)
+              / PIT_TICK;
+  else if (!expired_in_handler)
+    elapsed--;
+  countdown_armed = false;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  /* The handler invocation that ends the countdown counts as a
+     tick with an interrupt. */
+  intr_stats.tickless_ticks += expired_in_handler ? elapsed - 1 : elapsed;
+  return countdown_base + elapsed > ticks ? countdown_base + elapsed : ticks;
+}
+
+/* Blocks the running thread for NS nanoseconds, less than a tick,
+   on a high-resolution deadline. */
+static void
+hr_sleep (int64_t ns)
+{
+  struct hrsleeper s;
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  s.deadline = timer_nanoseconds () + ns;
+  s.thread = thread_current ();
+  for (e = list_begin (&hrsleepers); e != list_end (&hrsleepers);
+       e = list_next (e))
+    if (list_entry (e, struct hrsleeper, elem)->deadline > s.deadline)
+      break;
+  list_insert (e, &s.elem);
+  hr_program ();
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Wakes up the threads whose deadline has passed.  Called from the
+   timer interrupt. */
+static void
+hr_wakeup (void)
+{
+  int64_t now = timer_nanoseconds ();
+  bool preempt = false;
+
+  while (!list_empty (&hrsleepers))
+    {
+      struct hrsleeper *s = list_entry (list_front (&hrsleepers),
+                                        struct hrsleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hrsleepers);
+      thread_unblock (s->thread);
+      if (thread_preempts (s->thread))
+        preempt = true;
+    }
+  if (preempt)
+    intr_yield_on_return ();
+}
+
+/* Points channel 0 at whichever comes first, the first sleeper's
+   deadline or the next tick.  Interrupts must be off. */
+static void
+hr_program (void)
+{
+  bool expired;
+  uint16_t count;
+  int tick_left;
+  int64_t d;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!hr_armed && list_empty (&hrsleepers))
+    return;
+  ASSERT (!countdown_armed);
+
+  /* Find how many PIT cycles remain until the next tick. */
+  count = pit_read_counter (0, &expired);
+  if (hr_armed)
+    {
+      /* Leave an expired countdown to its pending interrupt. */
+      if (expired && !intr_context ())
+        return;
+      tick_left = (expired ? 0 : count) + hr_tick_left;
+    }
+  else
+    tick_left = count == 0 || count > PIT_TICK ? PIT_TICK : count;
+
+  d = tick_left;
+  if (!list_empty (&hrsleepers))
+    {
+      struct hrsleeper *s = list_entry (list_front (&hrsleepers),
+                                        struct hrsleeper, elem);
+      int64_t ns = s->deadline - timer_nanoseconds ();
+      if (ns < d * NSEC_PER_SEC / PIT_HZ)
+        d = ns <= 0 ? 1 : DIV_ROUND_UP (ns * PIT_HZ, NSEC_PER_SEC);
+    }
+
+  /* The periodic tick comes first anyway. */
+  if (d >= tick_left && !hr_armed)
+    return;
+  if (d > tick_left)
+    d = tick_left;
+
+  hr_armed = true;
+  hr_tick_left = tick_left - d;
+  pit_start_countdown (0, d);
+}
+
+/* Returns the processor's time-stamp counter.  See [IA32-v2b]
+   "RDTSC". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -228,6 +567,7 @@ real_time_sleep (int64_t num, int32_t denom)
      1 s / TIMER_FREQ ticks
   */
   int64_t ticks = num * TIMER_FREQ / denom;
+  int64_t ns = num * (NSEC_PER_SEC / denom);
 
   ASSERT (intr_get_level () == INTR_ON);
   if (ticks > 0)
@@ -237,6 +577,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_hz != 0 && ns >= HRSLEEP_MIN_NS)
+    {
+      /* Otherwise, block until a high-resolution deadline, which
+         also yields the CPU. */
+      hr_sleep (ns);
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
@@ -2,16 +2,22 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, stop the periodic tick while idle (-tickless).
+   If false (default), tick TIMER_FREQ times per second always. */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_nanoseconds (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -24,6 +30,25 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Time spent in the timer interrupt handler, with interrupts
+   off, measured in time-stamp counter cycles, and how much of
+   the time the CPU had nothing to do. */
+struct timer_intr_stats
+  {
+    int64_t ticks;              /* Number of handler invocations. */
+    uint64_t total_cycles;      /* Cycles spent in all of them. */
+    uint64_t max_cycles;        /* Cycles spent in the longest one. */
+    int64_t tickless_ticks;     /* Ticks that passed without one. */
+    uint64_t idle_cycles;       /* Cycles spent halted while idle. */
+  };
+
+void timer_get_intr_stats (struct timer_intr_stats *);
+void timer_reset_intr_stats (void);
+
+/* Dynamic ticks, driven by the idle thread. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
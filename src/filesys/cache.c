@@ -0,0 +1,431 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between write-backs of dirty sectors by the flush thread. */
+#define CACHE_FLUSH_TICKS (5 * TIMER_FREQ)
+
+/* Most sectors brought in from disk with one transfer. */
+#define CACHE_RUN_MAX 8
+
+/* Read-ahead requests that may be outstanding at once.  Further
+   requests are dropped until the read-ahead thread catches up. */
+#define READAHEAD_QUEUE 32
+
+/* A cached sector of the file system device.
+
+   SECTOR, VALID, ACCESSED and PIN_CNT are protected by
+   cache_lock; DIRTY and DATA by the entry's own LOCK.  An entry
+   is only ever locked by a thread that has pinned it, so an
+   unpinned entry's lock can always be taken without blocking. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* Holds a sector at all? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* Users; pinned entries are not evicted. */
+    bool dirty;                         /* Newer than the copy on disk? */
+    struct lock lock;                   /* Serializes I/O and copies. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when PIN_CNT drops to 0. */
+static int clock_hand;                  /* Next entry considered for eviction. */
+
+/* Ring of sectors waiting to be read ahead. */
+static block_sector_t readahead_queue[READAHEAD_QUEUE];
+static int readahead_head;              /* Oldest request. */
+static int readahead_cnt;               /* Number of requests queued. */
+static struct lock readahead_lock;
+static struct condition readahead_pending;
+static uint8_t readahead_buffer[CACHE_RUN_MAX * BLOCK_SECTOR_SIZE];
+
+static thread_func flush_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+static struct cache_entry *cache_get (block_sector_t, bool need_read,
+                                      bool demand);
+static void cache_fill (block_sector_t, size_t cnt, uint8_t *buffer,
+                        bool demand);
+static void cache_claim (struct cache_entry *, block_sector_t, bool demand);
+static void cache_put (struct cache_entry *, bool dirty);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+
+/* Initializes the buffer cache and starts the threads that
+   periodically write dirty sectors back to disk and that read
+   sectors ahead of sequential readers. */
+void
+cache_init (void)
+{
+  int i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].valid = false;
+      cache[i].pin_cnt = 0;
+      cache[i].dirty = false;
+      lock_init (&cache[i].lock);
+    }
+  clock_hand = 0;
+
+  lock_init (&readahead_lock);
+  cond_init (&readahead_pending);
+  readahead_head = readahead_cnt = 0;
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Copies SIZE bytes starting at SECTOR_OFS within SECTOR of the
+   file system device into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int sector_ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0
+          && sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, true);
+  memcpy (buffer, e->data + sector_ofs, size);
+  cache_put (e, false);
+}
+
+/* Copies CNT whole sectors starting at SECTOR of the file system
+   device into BUFFER.  Runs of sectors that are not cached are
+   read from disk with one multi-sector transfer each. */
+void
+cache_read_multiple (block_sector_t sector, size_t cnt, void *buffer)
+{
+  cache_fill (sector, cnt, buffer, true);
+}
+
+/* Copies SIZE bytes from BUFFER to SECTOR_OFS within SECTOR of
+   the file system device.  The sector reaches the disk when it
+   is evicted or flushed.  Overwriting a whole sector does not
+   read it in first. */
+void
+cache_write (block_sector_t sector, const void *buffer, int sector_ofs,
+             int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0
+          && sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, true);
+  memcpy (e->data + sector_ofs, buffer, size);
+  cache_put (e, true);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Never blocks on I/O; the request is dropped
+   if too many are already outstanding. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE)
+    {
+      readahead_queue[(readahead_head + readahead_cnt) % READAHEAD_QUEUE]
+        = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_pending, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+cache_flush (void)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->valid || !e->dirty)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e, false);
+    }
+}
+
+/* Returns the entry holding SECTOR, pinned and locked, reading
+   the sector in from disk on a miss if NEED_READ is true.  If
+   NEED_READ is false the caller must overwrite the whole sector.
+   DEMAND is false for read-ahead, which is left out of the hit
+   and miss counts and does not mark the entry accessed, so that
+   sectors read ahead but never used are the first to go. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool need_read, bool demand)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          e->pin_cnt++;
+          e->accessed |= demand;
+          lock_release (&cache_lock);
+          if (demand)
+            block_cache_stat (fs_device, true);
+
+          /* Waits out a miss still reading the sector in. */
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = cache_evict ();
+      if (e == NULL)
+        cond_wait (&cache_unpinned, &cache_lock);
+      else if (cache_lookup (sector) == NULL)
+        break;
+    }
+
+  cache_claim (e, sector, demand);
+  lock_release (&cache_lock);
+  if (demand)
+    block_cache_stat (fs_device, false);
+
+  if (need_read)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Brings CNT consecutive sectors starting at SECTOR into the
+   cache and copies them to BUFFER, which must have room for all
+   of them.  Each run of uncached sectors, up to CACHE_RUN_MAX
+   long, is read with a single multi-sector transfer straight
+   into BUFFER and then copied into its entries.  DEMAND is as
+   for cache_get(); without it, cached sectors are not copied. */
+static void
+cache_fill (block_sector_t sector, size_t cnt, uint8_t *buffer, bool demand)
+{
+  while (cnt > 0)
+    {
+      struct cache_entry *run[CACHE_RUN_MAX];
+      struct cache_entry *e;
+      size_t n, i;
+
+      lock_acquire (&cache_lock);
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          e->accessed |= demand;
+          if (demand)
+            {
+              e->pin_cnt++;
+              lock_release (&cache_lock);
+              block_cache_stat (fs_device, true);
+              lock_acquire (&e->lock);
+              memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+              cache_put (e, false);
+            }
+          else
+            lock_release (&cache_lock);
+          n = 1;
+        }
+      else
+        {
+          n = 0;
+          while (n < cnt && n < CACHE_RUN_MAX
+                 && (n == 0 || cache_lookup (sector + n) == NULL))
+            {
+              e = cache_evict ();
+              if (e == NULL || cache_lookup (sector + n) != NULL)
+                break;
+              cache_claim (e, sector + n, demand);
+              run[n++] = e;
+            }
+          if (n == 0)
+            {
+              /* Retried, as the sector may have come in while
+                 cache_evict() wrote a victim back. */
+              if (e == NULL)
+                cond_wait (&cache_unpinned, &cache_lock);
+              lock_release (&cache_lock);
+              continue;
+            }
+          lock_release (&cache_lock);
+
+          for (i = 0; demand && i < n; i++)
+            block_cache_stat (fs_device, false);
+          block_read_multiple (fs_device, sector, n, buffer);
+          for (i = 0; i < n; i++)
+            {
+              memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE);
+              cache_put (run[i], false);
+            }
+        }
+
+      sector += n;
+      cnt -= n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Makes free entry E hold SECTOR, pinned once and locked by the
+   caller.  Done before cache_lock is dropped, so that concurrent
+   lookups of SECTOR find E and wait on its lock until the caller
+   has filled it in.  Caller must hold cache_lock. */
+static void
+cache_claim (struct cache_entry *e, block_sector_t sector, bool demand)
+{
+  ASSERT (!e->valid && e->pin_cnt == 0);
+
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = demand;
+  e->pin_cnt = 1;
+  lock_acquire (&e->lock);
+}
+
+/* Unlocks and unpins E, marking it dirty if DIRTY is true. */
+static void
+cache_put (struct cache_entry *e, bool dirty)
+{
+  if (dirty)
+    e->dirty = true;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the valid entry holding SECTOR, or a null pointer if
+   SECTOR is not cached.  Caller must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Picks an entry to reuse with the clock algorithm, writing it
+   back first if it is dirty, and marks it invalid.  Returns a
+   null pointer if every entry is pinned.  Caller must hold
+   cache_lock, which is released during a write-back, so any
+   lookup done before the call must be done again. */
+static struct cache_entry *
+cache_evict (void)
+{
+  int i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!e->valid)
+        return e;
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      /* Written back with cache_lock released, pinned and still
+         holding the old sector, so that a thread wanting that
+         sector finds it here and waits on its lock rather than
+         reading the stale copy on disk.  It may have been used
+         again meanwhile, in which case it is passed over. */
+      if (e->dirty)
+        {
+          e->pin_cnt++;
+          lock_acquire (&e->lock);
+          lock_release (&cache_lock);
+
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          lock_release (&e->lock);
+
+          lock_acquire (&cache_lock);
+          if (--e->pin_cnt > 0 || e->accessed || e->dirty)
+            {
+              if (e->pin_cnt == 0)
+                cond_signal (&cache_unpinned, &cache_lock);
+              continue;
+            }
+        }
+      e->valid = false;
+      return e;
+    }
+  return NULL;
+}
+
+/* Writes dirty sectors back every CACHE_FLUSH_TICKS, so that a
+   crash loses at most that much work. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Reads queued sectors into the cache, skipping those that are
+   already there.  Requests for consecutive sectors are merged so
+   that they go to disk as one transfer. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_pending, &readahead_lock);
+      sector = readahead_queue[readahead_head];
+      cnt = 0;
+      do
+        {
+          readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+          readahead_cnt--;
+          cnt++;
+        }
+      while (readahead_cnt > 0 && cnt < CACHE_RUN_MAX
+             && readahead_queue[readahead_head] == sector + cnt);
+      lock_release (&readahead_lock);
+
+      cache_fill (sector, cnt, readahead_buffer, false);
+    }
+}
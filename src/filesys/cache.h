@@ -0,0 +1,17 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, int sector_ofs, int size);
+void cache_read_multiple (block_sector_t, size_t cnt, void *buffer);
+void cache_write (block_sector_t, const void *buffer, int sector_ofs,
+                  int size);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+
+#endif /* filesys/cache.h */
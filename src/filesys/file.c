@@ -1,16 +1,30 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Bounds on the read-ahead window, in sectors. */
+#define RA_MIN_WINDOW 2
+#define RA_MAX_WINDOW 16
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead state, see file_read_ahead(). */
+    off_t ra_last;              /* Offset of the last read. */
+    off_t ra_stride;            /* Distance between the last two reads. */
+    off_t ra_next;              /* End of the last read. */
+    off_t ra_queued;            /* Sequential read-ahead issued up to here. */
+    int ra_window;              /* Sectors to read ahead, 0 if no stream. */
   };
 
+static void file_read_ahead (struct file *, off_t size, off_t file_ofs);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +37,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = -1;
       return file;
     }
   else
@@ -69,6 +84,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, bytes_read, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +97,16 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_read_ahead (file, bytes_read, file_ofs);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +119,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -166,3 +182,68 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Notes a read of SIZE bytes at FILE_OFS in FILE and, if it
+   continues a stream, has the buffer cache fetch what the stream
+   will read next in the background.
+
+   A read starting where the last one ended is sequential; the
+   next RA_WINDOW sectors past it are read ahead.  A read whose
+   distance from the last one repeats the previous distance is
+   strided; the next reads at that stride are read ahead, about
+   RA_WINDOW sectors' worth.  The window starts at the size of
+   the read (at least RA_MIN_WINDOW), doubles for every read that
+   keeps the stream going up to RA_MAX_WINDOW, and collapses
+   when the pattern breaks. */
+static void
+file_read_ahead (struct file *file, off_t size, off_t file_ofs)
+{
+  off_t stride = file_ofs - file->ra_last;
+  bool sequential = file_ofs == file->ra_next;
+  bool strided = !sequential && stride > 0 && stride == file->ra_stride;
+  int sectors = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+
+  if (size > 0 && (sequential || strided))
+    {
+      if (file->ra_window == 0)
+        file->ra_window = sectors > RA_MIN_WINDOW ? sectors : RA_MIN_WINDOW;
+      else if (file->ra_window < RA_MAX_WINDOW)
+        file->ra_window *= 2;
+      if (file->ra_window > RA_MAX_WINDOW)
+        file->ra_window = RA_MAX_WINDOW;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_queued = 0;
+    }
+  file->ra_last = file_ofs;
+  file->ra_stride = stride;
+  file->ra_next = file_ofs + size;
+
+  if (file->ra_window == 0)
+    return;
+
+  if (sequential)
+    {
+      /* Only ask for what earlier calls have not asked for yet. */
+      off_t start = file->ra_next > file->ra_queued
+                    ? file->ra_next : file->ra_queued;
+      off_t end = file->ra_next + file->ra_window * BLOCK_SECTOR_SIZE;
+      if (start < end)
+        {
+          inode_read_ahead (file->inode, end - start, start);
+          file->ra_queued = end;
+        }
+    }
+  else
+    {
+      int reads = file->ra_window / (sectors + 1);
+      int i;
+
+      if (reads < 1)
+        reads = 1;
+      for (i = 1; i <= reads; i++)
+        inode_read_ahead (file->inode, size, file_ofs + i * stride);
+    }
+}
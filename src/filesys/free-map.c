@@ -4,9 +4,11 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Guards free_map now that files grow. */
 
 /* Initializes the free map. */
 void
@@ -17,6 +19,7 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,6 +30,7 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
+  lock_acquire (&free_map_lock);
   block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
@@ -35,18 +39,68 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors, preferring
+   one that starts at HINT, and stores its first sector into
+   *SECTORP.  Falls back to the first run of CNT free sectors
+   anywhere, halving CNT while there is none.
+   Returns the number of sectors allocated, 0 if the disk is full
+   or the free_map file could not be written. */
+size_t
+free_map_allocate_extent (size_t cnt, block_sector_t hint,
+                          block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  size_t got = 0;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  while (got < cnt && hint + got < bitmap_size (free_map)
+         && !bitmap_test (free_map, hint + got))
+    got++;
+  if (got > 0)
+    {
+      sector = hint;
+      bitmap_set_multiple (free_map, sector, got, true);
+    }
+  else
+    for (got = cnt; got > 0; got /= 2)
+      {
+        sector = bitmap_scan_and_flip (free_map, 0, got, false);
+        if (sector != BITMAP_ERROR)
+          break;
+      }
+
+  if (got > 0
+      && free_map_file != NULL
+      && !bitmap_write (free_map, free_map_file))
+    {
+      bitmap_set_multiple (free_map, sector, got, false);
+      got = 0;
+    }
+  lock_release (&free_map_lock);
+
+  if (got > 0)
+    *sectorp = sector;
+  return got;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (free_map_file != NULL)
+    bitmap_write (free_map, free_map_file);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,7 +118,12 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  lock_acquire (&free_map_lock);
+  if (!bitmap_write (free_map, free_map_file))
+    PANIC ("can't write free map");
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
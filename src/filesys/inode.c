@@ -3,21 +3,47 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of COUNT contiguous sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector of the run. */
+    uint32_t count;                     /* Number of sectors. */
+  };
+
+/* Extents held in the inode itself, and in its overflow block. */
+#define INODE_EXTENTS 62
+#define OVERFLOW_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (INODE_EXTENTS + OVERFLOW_EXTENTS)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   The file's data is the concatenation of its extents, the first
+   INODE_EXTENTS here and any others in the OVERFLOW sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    block_sector_t overflow;            /* Overflow extent block, or 0. */
+    struct extent extents[INODE_EXTENTS];
+  };
+
+/* Extent block holding the extents that don't fit in the inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent extents[OVERFLOW_EXTENTS];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -36,21 +62,172 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Serializes growth. */
     struct inode_disk data;             /* Inode content. */
+    struct extent_block overflow;       /* Overflow extents, if any. */
+    uint32_t ext_end[MAX_EXTENTS];      /* Sectors in extents 0...i. */
   };
 
+/* Returns extent I of INODE. */
+static struct extent *
+extent_at (struct inode *inode, size_t i)
+{
+  ASSERT (i < MAX_EXTENTS);
+  return (i < INODE_EXTENTS
+          ? &inode->data.extents[i]
+          : &inode->overflow.extents[i - INODE_EXTENTS]);
+}
+
+/* Returns the number of data sectors allocated to INODE. */
+static size_t
+allocated_sectors (const struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  return cnt > 0 ? inode->ext_end[cnt - 1] : 0;
+}
+
+/* Returns the index of the extent of INODE that holds data
+   sector IDX, which must be allocated.  Binary searches the
+   running extent totals, so the lookup costs no disk access
+   however fragmented the file is. */
+static size_t
+find_extent (const struct inode *inode, size_t idx)
+{
+  size_t lo = 0;
+  size_t hi = inode->data.extent_cnt - 1;
+
+  ASSERT (idx < allocated_sectors (inode));
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode->ext_end[mid] > idx)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return lo;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  size_t idx, ext;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  idx = pos / BLOCK_SECTOR_SIZE;
+  if (pos < 0 || idx >= allocated_sectors (inode))
     return -1;
+
+  ext = find_extent (inode, idx);
+  return extent_at (inode, ext)->start
+         + (idx - (ext > 0 ? inode->ext_end[ext - 1] : 0));
+}
+
+/* Returns how many of the MAX data sectors starting with the one
+   holding byte offset POS in INODE lie consecutively on disk,
+   which is at least 1 if POS is allocated. */
+static size_t
+contiguous_sectors (struct inode *inode, off_t pos, size_t max)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  size_t left;
+
+  if (pos < 0 || idx >= allocated_sectors (inode))
+    return 0;
+  left = inode->ext_end[find_extent (inode, idx)] - idx;
+  return left < max ? left : max;
+}
+
+/* Allocates and zeroes sectors until INODE has enough for LENGTH
+   bytes, extending its last extent in place when the sectors
+   after it are free.  Only updates INODE in memory; the caller
+   writes it back with inode_write_disk().
+   Readers look up sectors without INODE's lock, so the running
+   totals are updated before the extent they cover is, and
+   byte_to_sector() never depends on the count of an extent.
+   Returns false if the disk is full or INODE runs out of
+   extents, in which case the sectors allocated so far are kept. */
+static bool
+inode_extend (struct inode *inode, off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t have = allocated_sectors (inode);
+  size_t want = bytes_to_sectors (length);
+
+  while (have < want)
+    {
+      size_t cnt = inode->data.extent_cnt;
+      struct extent *last = cnt > 0 ? extent_at (inode, cnt - 1) : NULL;
+      block_sector_t hint = (last != NULL
+                             ? last->start + last->count
+                             : inode->sector + 1);
+      block_sector_t start;
+      size_t got, i;
+
+      /* Make sure there's room for a new extent before taking
+         sectors that might need one. */
+      if (cnt == MAX_EXTENTS)
+        return false;
+      if (cnt == INODE_EXTENTS && inode->data.overflow == 0)
+        {
+          if (!free_map_allocate (1, &inode->data.overflow))
+            return false;
+          memset (&inode->overflow, 0, sizeof inode->overflow);
+        }
+
+      got = free_map_allocate_extent (want - have, hint, &start);
+      if (got == 0)
+        return false;
+      for (i = 0; i < got; i++)
+        cache_write (start + i, zeros, 0, BLOCK_SECTOR_SIZE);
+
+      have += got;
+      if (last != NULL && start == hint)
+        {
+          inode->ext_end[cnt - 1] = have;
+          barrier ();
+          last->count += got;
+        }
+      else
+        {
+          struct extent *e = extent_at (inode, cnt);
+          e->start = start;
+          e->count = got;
+          inode->ext_end[cnt] = have;
+          barrier ();
+          inode->data.extent_cnt = cnt + 1;
+        }
+    }
+  return true;
+}
+
+/* Writes INODE's on-disk inode, and its overflow block if it has
+   one, to the buffer cache. */
+static void
+inode_write_disk (struct inode *inode)
+{
+  cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (inode->data.overflow != 0)
+    cache_write (inode->data.overflow, &inode->overflow, 0,
+                 BLOCK_SECTOR_SIZE);
+}
+
+/* Returns all of INODE's data sectors and its overflow block to
+   the free map. */
+static void
+inode_release_sectors (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    free_map_release (extent_at (inode, i)->start,
+                      extent_at (inode, i)->count);
+  if (inode->data.overflow != 0)
+    free_map_release (inode->data.overflow, 1);
 }
 
 /* List of open inodes, so that opening a single inode twice
@@ -72,35 +249,32 @@ inode_init (void)
 bool
 inode_create (block_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
+  struct inode *inode = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  /* If these assertions fail, the on-disk structures are not
+     exactly one sector in size, and you should fix that. */
+  ASSERT (sizeof inode->data == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof inode->overflow == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  /* Build the inode in memory, so that it can be grown the same
+     way an open one is. */
+  inode = calloc (1, sizeof *inode);
+  if (inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      inode->sector = sector;
+      inode->data.magic = INODE_MAGIC;
+      if (inode_extend (inode, length)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          inode->data.length = length;
+          inode_write_disk (inode);
           success = true; 
         } 
-      free (disk_inode);
+      else
+        inode_release_sectors (inode);
+      free (inode);
     }
   return success;
 }
@@ -113,6 +287,7 @@ inode_open (block_sector_t sector)
 {
   struct list_elem *e;
   struct inode *inode;
+  size_t i, total;
 
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
@@ -137,7 +312,18 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (inode->data.overflow != 0)
+    cache_read (inode->data.overflow, &inode->overflow, 0,
+                BLOCK_SECTOR_SIZE);
+
+  total = 0;
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    {
+      total += extent_at (inode, i)->count;
+      inode->ext_end[i] = total;
+    }
   return inode;
 }
 
@@ -177,8 +363,7 @@ inode_close (struct inode *inode)
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          inode_release_sectors (inode);
         }
 
       free (inode); 
@@ -201,8 +386,8 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
-  off_t bytes_read = 0;
   uint8_t *bounce = NULL;
+  off_t bytes_read = 0;
 
   while (size > 0) 
     {
@@ -220,51 +405,100 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE
+          && (is_kernel_vaddr (buffer) || bounce != NULL
+              || (bounce = palloc_get_page (0)) != NULL))
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          /* Read every whole sector that follows this one on disk
+             with one call, so uncached runs become one transfer.
+             User memory may not be paged in, and faulting it in
+             may need the disk whose lock the transfer holds, so
+             a read for a user buffer goes through a kernel page
+             and is copied out once the disk is released. */
+          off_t left = size < inode_left ? size : inode_left;
+          size_t cnt = left / BLOCK_SECTOR_SIZE;
+
+          if (is_kernel_vaddr (buffer))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              cnt = contiguous_sectors (inode, offset, cnt);
+              cache_read_multiple (sector_idx, cnt, buffer + bytes_read);
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          else
+            {
+              if (cnt > PGSIZE / BLOCK_SECTOR_SIZE)
+                cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+              cnt = contiguous_sectors (inode, offset, cnt);
+              cache_read_multiple (sector_idx, cnt, bounce);
+              memcpy (buffer + bytes_read, bounce, cnt * BLOCK_SECTOR_SIZE);
+            }
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
-      
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  palloc_free_page (bounce);
 
   return bytes_read;
 }
 
+/* Queues the sectors holding SIZE bytes of INODE starting at
+   OFFSET for read-ahead into the buffer cache.  Bytes past the
+   end of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+  off_t pos;
+
+  if (offset < 0 || end > inode_length (inode))
+    end = inode_length (inode);
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    cache_read_ahead (byte_to_sector (inode, pos));
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode; any gap between
+   the old end and OFFSET reads back as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t length;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Allocate the sectors for a write past end of file up front.
+     The new length is only published once the data is in place,
+     so that readers never see the tail before it is written. */
+  length = inode_length (inode);
+  if (offset + size > length)
+    {
+      off_t limit;
+
+      /* Whatever was allocated goes on disk now, even if the
+         disk filled up part way or the write never gets to it,
+         so that the sectors are not lost from the free map.
+         They lie past the length and are reused when the file
+         grows, or freed with the rest when it is removed. */
+      lock_acquire (&inode->lock);
+      inode_extend (inode, offset + size);
+      inode_write_disk (inode);
+      limit = (off_t) allocated_sectors (inode) * BLOCK_SECTOR_SIZE;
+      lock_release (&inode->lock);
+      length = offset + size < limit ? offset + size : limit;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -272,7 +506,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,38 +515,30 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache only reads the sector in first if the chunk
+         does not cover all of it. */
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* OFFSET is past what was allocated if the disk filled up
+     before reaching it, so only publish a length that covers
+     bytes actually written. */
+  if (bytes_written > 0 && offset > inode_length (inode))
+    {
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          inode_write_disk (inode);
+        }
+      lock_release (&inode->lock);
+    }
 
   return bytes_written;
 }
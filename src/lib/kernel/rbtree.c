@@ -0,0 +1,273 @@
+/* Left-leaning red-black tree.
+
+   The algorithms follow R. Sedgewick, "Left-leaning Red-Black
+   Trees", 2008: every operation walks down from the root and
+   restores the invariants on the way back up, so elements need
+   no parent pointers.  A red link always leans left, and no path
+   has two red links in a row.
+
+   See rbtree.h for basic information. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static int compare (const struct rbtree *, const struct rbtree_elem *,
+                    const struct rbtree_elem *);
+static bool is_red (const struct rbtree_elem *);
+static struct rbtree_elem *rotate_left (struct rbtree_elem *);
+static struct rbtree_elem *rotate_right (struct rbtree_elem *);
+static void flip_colors (struct rbtree_elem *);
+static struct rbtree_elem *move_red_left (struct rbtree_elem *);
+static struct rbtree_elem *move_red_right (struct rbtree_elem *);
+static struct rbtree_elem *fix_up (struct rbtree_elem *);
+static struct rbtree_elem *insert (struct rbtree *, struct rbtree_elem *,
+                                   struct rbtree_elem *);
+static struct rbtree_elem *remove_min (struct rbtree_elem *);
+static struct rbtree_elem *remove_elem (struct rbtree *,
+                                        struct rbtree_elem *,
+                                        struct rbtree_elem *);
+
+/* Initializes tree T to compare elements using LESS, given
+   auxiliary data AUX. */
+void
+rbtree_init (struct rbtree *t, rbtree_less_func *less, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E, which must not already be in a tree, into T. */
+void
+rbtree_insert (struct rbtree *t, struct rbtree_elem *e) 
+{
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  e->left = e->right = NULL;
+  e->red = true;
+  t->root = insert (t, t->root, e);
+  t->root->red = false;
+  t->elem_cnt++;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+rbtree_remove (struct rbtree *t, struct rbtree_elem *e) 
+{
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+  ASSERT (t->elem_cnt > 0);
+
+  if (!is_red (t->root->left) && !is_red (t->root->right))
+    t->root->red = true;
+  t->root = remove_elem (t, t->root, e);
+  if (t->root != NULL)
+    t->root->red = false;
+  t->elem_cnt--;
+}
+
+/* Returns the least element in T, or a null pointer if T is
+   empty. */
+struct rbtree_elem *
+rbtree_min (const struct rbtree *t) 
+{
+  struct rbtree_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->left != NULL)
+      e = e->left;
+  return e;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rbtree_size (const struct rbtree *t) 
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+rbtree_empty (const struct rbtree *t) 
+{
+  return t->elem_cnt == 0;
+}
+
+/* Returns a negative number, zero, or a positive number as A is
+   less than, the same as, or greater than B in T's order.  Ties
+   in T's comparison function are broken by address, so that
+   only an element compares the same as itself. */
+static int
+compare (const struct rbtree *t, const struct rbtree_elem *a,
+         const struct rbtree_elem *b) 
+{
+  if (t->less (a, b, t->aux))
+    return -1;
+  else if (t->less (b, a, t->aux))
+    return 1;
+  else
+    return a < b ? -1 : a > b;
+}
+
+/* Returns true if the link to E is red.  Null links are black. */
+static bool
+is_red (const struct rbtree_elem *e) 
+{
+  return e != NULL && e->red;
+}
+
+/* Turns H's red right link into a left one, and returns the new
+   root of the subtree. */
+static struct rbtree_elem *
+rotate_left (struct rbtree_elem *h) 
+{
+  struct rbtree_elem *x = h->right;
+
+  h->right = x->left;
+  x->left = h;
+  x->red = h->red;
+  h->red = true;
+  return x;
+}
+
+/* Turns H's red left link into a right one, and returns the new
+   root of the subtree. */
+static struct rbtree_elem *
+rotate_right (struct rbtree_elem *h) 
+{
+  struct rbtree_elem *x = h->left;
+
+  h->left = x->right;
+  x->right = h;
+  x->red = h->red;
+  h->red = true;
+  return x;
+}
+
+/* Flips the colors of H and its two children. */
+static void
+flip_colors (struct rbtree_elem *h) 
+{
+  h->red = !h->red;
+  h->left->red = !h->left->red;
+  h->right->red = !h->right->red;
+}
+
+/* Makes H's left link or one of its children red, given that H
+   is red and both are black, and returns the new root of the
+   subtree. */
+static struct rbtree_elem *
+move_red_left (struct rbtree_elem *h) 
+{
+  flip_colors (h);
+  if (is_red (h->right->left)) 
+    {
+      h->right = rotate_right (h->right);
+      h = rotate_left (h);
+      flip_colors (h);
+    }
+  return h;
+}
+
+/* Makes H's right link or one of its children red, given that H
+   is red and both are black, and returns the new root of the
+   subtree. */
+static struct rbtree_elem *
+move_red_right (struct rbtree_elem *h) 
+{
+  flip_colors (h);
+  if (is_red (h->left->left)) 
+    {
+      h = rotate_right (h);
+      flip_colors (h);
+    }
+  return h;
+}
+
+/* Restores the invariants at H on the way back up, and returns
+   the new root of the subtree. */
+static struct rbtree_elem *
+fix_up (struct rbtree_elem *h) 
+{
+  if (is_red (h->right) && !is_red (h->left))
+    h = rotate_left (h);
+  if (is_red (h->left) && is_red (h->left->left))
+    h = rotate_right (h);
+  if (is_red (h->left) && is_red (h->right))
+    flip_colors (h);
+  return h;
+}
+
+/* Inserts E into the subtree of T rooted at H, and returns the
+   new root of the subtree. */
+static struct rbtree_elem *
+insert (struct rbtree *t, struct rbtree_elem *h, struct rbtree_elem *e) 
+{
+  if (h == NULL)
+    return e;
+
+  if (compare (t, e, h) < 0)
+    h->left = insert (t, h->left, e);
+  else
+    h->right = insert (t, h->right, e);
+  return fix_up (h);
+}
+
+/* Removes the least element from the subtree rooted at H, and
+   returns the new root of the subtree. */
+static struct rbtree_elem *
+remove_min (struct rbtree_elem *h) 
+{
+  if (h->left == NULL)
+    return NULL;
+
+  if (!is_red (h->left) && !is_red (h->left->left))
+    h = move_red_left (h);
+  h->left = remove_min (h->left);
+  return fix_up (h);
+}
+
+/* Removes E from the subtree of T rooted at H, and returns the
+   new root of the subtree. */
+static struct rbtree_elem *
+remove_elem (struct rbtree *t, struct rbtree_elem *h,
+             struct rbtree_elem *e) 
+{
+  ASSERT (h != NULL);
+
+  if (compare (t, e, h) < 0) 
+    {
+      if (!is_red (h->left) && !is_red (h->left->left))
+        h = move_red_left (h);
+      h->left = remove_elem (t, h->left, e);
+    }
+  else 
+    {
+      if (is_red (h->left))
+        h = rotate_right (h);
+      if (h == e && h->right == NULL)
+        return NULL;
+      if (!is_red (h->right) && !is_red (h->right->left))
+        h = move_red_right (h);
+      if (h == e) 
+        {
+          /* Put E's successor in E's place, since the element
+             itself has to leave the tree, not just its key. */
+          struct rbtree_elem *min = h->right;
+          while (min->left != NULL)
+            min = min->left;
+          min->right = remove_min (h->right);
+          min->left = h->left;
+          min->red = h->red;
+          h = min;
+        }
+      else
+        h->right = remove_elem (t, h->right, e);
+    }
+  return fix_up (h);
+}
@@ -0,0 +1,62 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   This is a left-leaning red-black tree [Sedgewick 2008]: a
+   binary search tree whose height stays within twice the
+   logarithm of its size, so that insertion, removal and finding
+   the least element all take O(log n) time.
+
+   Like lists and hash tables, the tree does not use dynamic
+   allocation.  Each structure that can be in a tree embeds a
+   struct rbtree_elem member, and rbtree_entry converts a pointer
+   to it back to the structure that contains it.  Elements that
+   compare equal are kept in the tree in an arbitrary but fixed
+   order.  An element's key must not change while it is in a
+   tree; remove it, change the key, and insert it again instead. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Red-black tree element. */
+struct rbtree_elem 
+  {
+    struct rbtree_elem *left;   /* Lesser elements. */
+    struct rbtree_elem *right;  /* Greater elements. */
+    bool red;                   /* Color of the link from the parent. */
+  };
+
+/* Converts pointer to tree element RBTREE_ELEM into a pointer to
+   the structure that RBTREE_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define rbtree_entry(RBTREE_ELEM, STRUCT, MEMBER)               \
+        ((STRUCT *) ((uint8_t *) &(RBTREE_ELEM)->left           \
+                     - offsetof (STRUCT, MEMBER.left)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rbtree_less_func (const struct rbtree_elem *a,
+                               const struct rbtree_elem *b,
+                               void *aux);
+
+/* Red-black tree. */
+struct rbtree 
+  {
+    struct rbtree_elem *root;   /* Root, or null if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    rbtree_less_func *less;     /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void rbtree_init (struct rbtree *, rbtree_less_func *, void *aux);
+void rbtree_insert (struct rbtree *, struct rbtree_elem *);
+void rbtree_remove (struct rbtree *, struct rbtree_elem *);
+struct rbtree_elem *rbtree_min (const struct rbtree *);
+size_t rbtree_size (const struct rbtree *);
+bool rbtree_empty (const struct rbtree *);
+
+#endif /* lib/kernel/rbtree.h */
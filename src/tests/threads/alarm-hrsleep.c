@@ -0,0 +1,67 @@
+/* Sleeps for less than a timer tick, many times, with
+   timer_usleep() and timer_nsleep().  Verifies against
+   timer_nanoseconds() that no sleep ends early, and that a
+   lower-priority thread got to run meanwhile, which it can't if
+   the sleeps busy-wait. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITERATIONS 20
+
+static volatile bool done;
+static volatile int spins;
+
+static void spinner (void *);
+
+void
+test_alarm_hrsleep (void) 
+{
+  struct semaphore exited;
+  int early = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&exited, 0);
+  done = false;
+  spins = 0;
+  thread_create ("spinner", PRI_DEFAULT - 1, spinner, &exited);
+
+  msg ("Sleeping %d times for 500 us and for 200000 ns.", ITERATIONS);
+  for (i = 0; i < ITERATIONS; i++) 
+    {
+      int64_t start = timer_nanoseconds ();
+      timer_usleep (500);
+      if (timer_nanoseconds () - start < 500 * 1000)
+        early++;
+
+      start = timer_nanoseconds ();
+      timer_nsleep (200000);
+      if (timer_nanoseconds () - start < 200000)
+        early++;
+    }
+  msg ("%d early wakeups.", early);
+  if (spins == 0)
+    fail ("lower-priority thread never ran during the sleeps");
+  msg ("Lower-priority thread ran during the sleeps.");
+
+  done = true;
+  sema_down (&exited);
+}
+
+/* Spins at low priority until the test is done. */
+static void
+spinner (void *exited_) 
+{
+  struct semaphore *exited = exited_;
+
+  while (!done)
+    spins++;
+  sema_up (exited);
+}
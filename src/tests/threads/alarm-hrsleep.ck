@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-hrsleep) begin
+(alarm-hrsleep) Sleeping 20 times for 500 us and for 200000 ns.
+(alarm-hrsleep) 0 early wakeups.
+(alarm-hrsleep) Lower-priority thread ran during the sleeps.
+(alarm-hrsleep) end
+EOF
+pass;
@@ -0,0 +1,108 @@
+/* Creates 1000 threads, each of which sleeps a different,
+   staggered duration several times.  Verifies that no thread
+   wakes up early and reports how long the timer interrupt
+   handler ran, with interrupts off, per tick while the sleepers
+   were being managed. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 1000
+#define ITERATIONS 3
+
+/* Information about the test. */
+struct stress_test 
+  {
+    struct lock lock;           /* Lock protecting the counters. */
+    int wakeups;                /* Number of wakeups so far. */
+    int early;                  /* Number of wakeups before time. */
+    struct semaphore done;      /* Upped by each thread on exit. */
+  };
+
+/* Information about an individual thread in the test. */
+struct stress_thread 
+  {
+    struct stress_test *test;   /* Info shared between all threads. */
+    int duration;               /* Number of ticks to sleep. */
+  };
+
+static void sleeper (void *);
+
+void
+test_alarm_stress (void) 
+{
+  struct stress_test test;
+  struct stress_thread *threads;
+  struct timer_intr_stats stats;
+  int i;
+
+  msg ("Creating %d threads to sleep %d times each.",
+       THREAD_CNT, ITERATIONS);
+  msg ("Thread i sleeps 1 + (i * 37) %% 200 ticks each time.");
+
+  threads = malloc (sizeof *threads * THREAD_CNT);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  lock_init (&test.lock);
+  test.wakeups = 0;
+  test.early = 0;
+  sema_init (&test.done, 0);
+
+  timer_reset_intr_stats ();
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct stress_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->duration = 1 + (i * 37) % 200;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  /* Wait for all the threads to finish. */
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+  timer_get_intr_stats (&stats);
+
+  msg ("%d wakeups, %d early.", test.wakeups, test.early);
+  msg ("Timer interrupt: %"PRId64" ticks, %"PRIu64" cycles avg, "
+       "%"PRIu64" cycles max with interrupts off.",
+       stats.ticks, stats.total_cycles / (stats.ticks > 0 ? stats.ticks : 1),
+       stats.max_cycles);
+
+  free (threads);
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_) 
+{
+  struct stress_thread *t = t_;
+  struct stress_test *test = t->test;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) 
+    {
+      int64_t wake_at = timer_ticks () + t->duration;
+      bool early;
+
+      timer_sleep (t->duration);
+      early = timer_ticks () < wake_at;
+
+      lock_acquire (&test->lock);
+      test->wakeups++;
+      if (early)
+        test->early++;
+      lock_release (&test->lock);
+    }
+  sema_up (&test->done);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Cycle counts vary from run to run, so only check that they were
+# reported, then match the rest of the output exactly.
+fail "No timer interrupt cost reported.\n"
+  if !grep (/Timer interrupt: \d+ ticks, \d+ cycles avg, \d+ cycles max/,
+	    @output);
+@output = grep (!/Timer interrupt: /, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(alarm-stress) begin
+(alarm-stress) Creating 1000 threads to sleep 3 times each.
+(alarm-stress) Thread i sleeps 1 + (i * 37) % 200 ticks each time.
+(alarm-stress) 3000 wakeups, 0 early.
+(alarm-stress) end
+EOF
+pass;
@@ -0,0 +1,98 @@
+/* Runs with the -tickless kernel option.  Creates a few threads
+   that sleep for long, staggered durations, so that the CPU is
+   idle most of the time.  Verifies that no thread wakes up early
+   and that the timer took fewer interrupts than ticks went by,
+   that is, that the tick was actually stopped while idle. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 3
+#define ITERATIONS 4
+
+/* Information about the test. */
+struct tickless_test 
+  {
+    struct lock lock;           /* Lock protecting the counter. */
+    int early;                  /* Number of wakeups before time. */
+    struct semaphore done;      /* Upped by each thread on exit. */
+  };
+
+/* Information about an individual thread in the test. */
+struct tickless_thread 
+  {
+    struct tickless_test *test; /* Info shared between all threads. */
+    int duration;               /* Number of ticks to sleep. */
+  };
+
+static void sleeper (void *);
+
+void
+test_alarm_tickless (void) 
+{
+  struct tickless_test test;
+  struct tickless_thread threads[THREAD_CNT];
+  struct timer_intr_stats stats;
+  int64_t start;
+  int i;
+
+  ASSERT (timer_tickless);
+
+  lock_init (&test.lock);
+  test.early = 0;
+  sema_init (&test.done, 0);
+
+  msg ("Creating %d threads to sleep %d times each.",
+       THREAD_CNT, ITERATIONS);
+  timer_reset_intr_stats ();
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct tickless_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->duration = 20 * (i + 1) + 7;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  /* Wait for all the threads to finish. */
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+  timer_get_intr_stats (&stats);
+
+  msg ("%d early wakeups.", test.early);
+  if (stats.ticks >= timer_elapsed (start))
+    fail ("%"PRId64" timer interrupts in %"PRId64" ticks.",
+          stats.ticks, timer_elapsed (start));
+  msg ("Fewer timer interrupts than ticks.");
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_) 
+{
+  struct tickless_thread *t = t_;
+  struct tickless_test *test = t->test;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) 
+    {
+      int64_t wake = timer_ticks () + t->duration;
+      timer_sleep (t->duration);
+      if (timer_ticks () < wake)
+        {
+          lock_acquire (&test->lock);
+          test->early++;
+          lock_release (&test->lock);
+        }
+    }
+  sema_up (&test->done);
+}
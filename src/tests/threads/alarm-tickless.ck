@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-tickless) begin
+(alarm-tickless) Creating 3 threads to sleep 4 times each.
+(alarm-tickless) 0 early wakeups.
+(alarm-tickless) Fewer timer interrupts than ticks.
+(alarm-tickless) end
+EOF
+pass;
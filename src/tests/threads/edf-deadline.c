@@ -0,0 +1,132 @@
+/* Puts a periodic thread and a CPU hog in the deadline class, with
+   higher-priority threads spinning in the background.  Verifies
+   that admission control refuses parameters that make no sense or
+   that would overload the class, that every job of the periodic
+   thread finishes by its deadline, and that the background thread
+   still runs, which it can't unless the hog is held to its budget. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define MS (1000 * 1000)
+
+/* Both threads ask for 4 ms in each 40 ms period, by the end of
+   the period.  A job of the periodic thread needs 1 ms of that. */
+#define RUNTIME (4 * MS)
+#define PERIOD (40 * MS)
+#define WORK (1 * MS)
+#define JOBS 25
+
+static struct semaphore admitted;
+static volatile bool done;
+static volatile int spins;
+static int misses;
+
+static void periodic (void *);
+static void hog (void *);
+static void spinner (void *);
+
+void
+test_edf_deadline (void)
+{
+  struct semaphore exited;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&admitted, 0);
+  sema_init (&exited, 0);
+  done = false;
+  spins = 0;
+  misses = 0;
+
+  thread_create ("periodic", PRI_DEFAULT + 1, periodic, &exited);
+  thread_create ("hog", PRI_DEFAULT + 1, hog, &exited);
+  sema_down (&admitted);
+  sema_down (&admitted);
+  msg ("Admitted periodic thread and hog.");
+
+  if (thread_set_deadline (PERIOD + 1, PERIOD, PERIOD))
+    fail ("admitted runtime longer than deadline");
+  if (thread_set_deadline (RUNTIME, PERIOD, PERIOD + 1))
+    fail ("admitted deadline longer than period");
+  msg ("Refused invalid parameters.");
+
+  if (thread_set_deadline (PERIOD - RUNTIME, PERIOD, PERIOD))
+    fail ("admitted more than the class's bandwidth");
+  msg ("Refused to overload the class.");
+
+  msg ("Running %d jobs with a spinning thread in the background...",
+       JOBS);
+  thread_create ("spinner", PRI_DEFAULT + 10, spinner, &exited);
+  sema_down (&exited);
+  sema_down (&exited);
+  sema_down (&exited);
+
+  msg ("%d deadline misses.", misses);
+  if (spins == 0)
+    fail ("background thread never ran while the hog did");
+  msg ("Background thread ran while the hog did.");
+}
+
+/* Does WORK ns of work in each period, and counts the jobs that
+   finish past their deadline. */
+static void
+periodic (void *exited_)
+{
+  struct semaphore *exited = exited_;
+  int64_t release;
+  int i;
+
+  if (!thread_set_deadline (RUNTIME, PERIOD, PERIOD))
+    fail ("periodic thread not admitted");
+  sema_up (&admitted);
+
+  release = timer_nanoseconds ();
+  for (i = 0; i < JOBS; i++)
+    {
+      int64_t now;
+
+      while (timer_nanoseconds () - release < WORK)
+        continue;
+      if (timer_nanoseconds () > release + PERIOD)
+        misses++;
+
+      release += PERIOD;
+      while ((now = timer_nanoseconds ()) < release)
+        timer_nsleep (release - now);
+    }
+
+  done = true;
+  sema_up (exited);
+}
+
+/* Spins in the deadline class until the test is done. */
+static void
+hog (void *exited_)
+{
+  struct semaphore *exited = exited_;
+
+  if (!thread_set_deadline (RUNTIME, PERIOD, PERIOD))
+    fail ("hog not admitted");
+  sema_up (&admitted);
+
+  while (!done)
+    continue;
+  sema_up (exited);
+}
+
+/* Spins outside the deadline class until the test is done. */
+static void
+spinner (void *exited_)
+{
+  struct semaphore *exited = exited_;
+
+  while (!done)
+    spins++;
+  sema_up (exited);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-deadline) begin
+(edf-deadline) Admitted periodic thread and hog.
+(edf-deadline) Refused invalid parameters.
+(edf-deadline) Refused to overload the class.
+(edf-deadline) Running 25 jobs with a spinning thread in the background...
+(edf-deadline) 0 deadline misses.
+(edf-deadline) Background thread ran while the hog did.
+(edf-deadline) end
+EOF
+pass;
@@ -0,0 +1,114 @@
+/* Checks how far the priorities of threads that are never
+   scheduled can trail the once-a-second decay of recent_cpu.
+
+   60 threads block on a semaphore, so they are neither enqueued
+   nor woken up and only the sweep over all threads, which
+   refreshes 8 of them per tick, brings them up to date.  With N
+   threads in all, every one of them must have had each decay
+   applied within ceil(N / 8) ticks of it.  The main thread
+   checks that 5 times in a row, each time that many ticks after
+   a decay. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <round.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 60
+#define ROUND_CNT 5
+
+/* Threads brought up to date per tick, REFRESH_BATCH in
+   threads/thread.c. */
+#define REFRESH_PER_TICK 8
+
+static struct semaphore release;
+
+/* Information gathered by count_lagging(). */
+struct lag_count
+  {
+    int64_t epoch;              /* Decays the main thread has had. */
+    int all;                    /* Threads in all. */
+    int lagging;                /* Threads behind EPOCH. */
+  };
+
+static thread_func blocked_thread;
+static thread_action_func count_lagging;
+
+void
+test_mlfqs_lag (void)
+{
+  enum intr_level old_level;
+  struct lag_count count;
+  int64_t lag_ticks;
+  int i;
+
+  ASSERT (thread_mlfqs);
+
+  msg ("Starting %d threads that stay blocked...", THREAD_CNT);
+  sema_init (&release, 0);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "blocked %d", i);
+      thread_create (name, PRI_DEFAULT, blocked_thread, NULL);
+    }
+
+  old_level = intr_disable ();
+  count.all = 0;
+  count.epoch = thread_current ()->decay_epoch;
+  count.lagging = 0;
+  thread_foreach (count_lagging, &count);
+  intr_set_level (old_level);
+  lag_ticks = DIV_ROUND_UP (count.all, REFRESH_PER_TICK);
+  ASSERT (lag_ticks < TIMER_FREQ);
+
+  msg ("Checking %d times that every thread had the last decay "
+       "applied within ceil(N / %d) ticks...",
+       ROUND_CNT, REFRESH_PER_TICK);
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      /* Wake up LAG_TICKS after the next decay.  Waking up brings
+         this thread up to date, so it has had every decay. */
+      timer_sleep (TIMER_FREQ - timer_ticks () % TIMER_FREQ + lag_ticks);
+
+      old_level = intr_disable ();
+      count.all = 0;
+      count.epoch = thread_current ()->decay_epoch;
+      count.lagging = 0;
+      thread_foreach (count_lagging, &count);
+      intr_set_level (old_level);
+
+      if (count.lagging > 0)
+        fail ("%d of %d threads missed a decay %"PRId64" ticks after it",
+              count.lagging, count.all, lag_ticks);
+    }
+  msg ("Every thread was up to date each time.");
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_up (&release);
+}
+
+static void
+blocked_thread (void *aux UNUSED)
+{
+  sema_down (&release);
+}
+
+/* Counts T, and counts it as lagging if it has had fewer decays
+   than the main thread.  The idle thread is never brought up to
+   date, as it has no priority to speak of. */
+static void
+count_lagging (struct thread *t, void *count_)
+{
+  struct lag_count *count = count_;
+
+  count->all++;
+  if (strcmp (t->name, "idle") && t->decay_epoch != count->epoch)
+    count->lagging++;
+}
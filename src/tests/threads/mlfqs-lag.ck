@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlfqs-lag) begin
+(mlfqs-lag) Starting 60 threads that stay blocked...
+(mlfqs-lag) Checking 5 times that every thread had the last decay applied within ceil(N / 8) ticks...
+(mlfqs-lag) Every thread was up to date each time.
+(mlfqs-lag) end
+EOF
+pass;
@@ -0,0 +1,181 @@
+/* Benchmarks the fairness and the wakeup latency of the scheduler
+   in use, so that the round-robin priority scheduler (default),
+   the MLFQS (-mlfqs) and the completely fair scheduler (-cfs) can
+   be compared by running the same load under each.
+
+   Three threads spin for 8 seconds, two with nice 0 and one with
+   nice 5, and count the ticks they see.  Only the nice-aware
+   schedulers give the third one less.  The fairness index of the
+   two nice-0 threads is 100% if they got exactly the same share.
+
+   Meanwhile an interactive thread sleeps 2 ms at a time, 100
+   times, and measures how much later than asked it gets to run
+   again.  That's up to a whole time slice when a woken thread
+   waits for the running one to use up its slice.  Waking up
+   early is a bug, so early wakeups are counted, not hidden.
+
+   Ticks and latencies vary from run to run and between policies.
+   The checker requires the nice-0 spinners to have been treated
+   fairly, the nice-aware schedulers to have given the nice-5
+   spinner less than either of them, and no early wakeups. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SPINNER_CNT 3
+#define WAKEUP_CNT 100
+#define SLEEP_NS (2 * 1000 * 1000)
+
+static const int spinner_nice[SPINNER_CNT] = {0, 0, 5};
+
+/* Information about a spinning thread. */
+struct spinner 
+  {
+    int64_t start_time;         /* Ticks at start of test. */
+    int nice;                   /* Nice value to run with. */
+    int tick_count;             /* Ticks seen while spinning. */
+  };
+
+/* Information about the interactive thread. */
+struct sleeper 
+  {
+    int64_t start_time;         /* Ticks at start of test. */
+    int64_t total_ns;           /* Sum of wakeup latencies. */
+    int64_t min_ns;             /* Shortest, negative if early. */
+    int64_t max_ns;             /* Longest wakeup latency. */
+    int early_cnt;              /* Wakeups before the deadline. */
+    struct semaphore done;      /* Upped when finished. */
+  };
+
+static void sched_bench (const char *policy);
+static void spinner_thread (void *);
+static void sleeper_thread (void *);
+
+void
+test_sched_bench_rr (void) 
+{
+  ASSERT (!thread_mlfqs && !thread_cfs);
+  sched_bench ("round-robin");
+}
+
+void
+test_sched_bench_mlfqs (void) 
+{
+  ASSERT (thread_mlfqs);
+  sched_bench ("mlfqs");
+}
+
+void
+test_sched_bench_cfs (void) 
+{
+  ASSERT (thread_cfs);
+  sched_bench ("cfs");
+}
+
+static void
+sched_bench (const char *policy) 
+{
+  struct spinner spinners[SPINNER_CNT];
+  struct sleeper sleeper;
+  int64_t start_time;
+  int64_t a, b;
+  int i;
+
+  msg ("Scheduler: %s.", policy);
+  msg ("Starting %d spinners and 1 sleeper...", SPINNER_CNT);
+  if (thread_mlfqs || thread_cfs)
+    thread_set_nice (-20);
+
+  start_time = timer_ticks ();
+  for (i = 0; i < SPINNER_CNT; i++) 
+    {
+      struct spinner *s = &spinners[i];
+      char name[16];
+
+      s->start_time = start_time;
+      s->nice = spinner_nice[i];
+      s->tick_count = 0;
+      snprintf (name, sizeof name, "spinner %d", i);
+      thread_create (name, PRI_DEFAULT, spinner_thread, s);
+    }
+  sleeper.start_time = start_time;
+  sleeper.total_ns = 0;
+  sleeper.min_ns = INT64_MAX;
+  sleeper.max_ns = INT64_MIN;
+  sleeper.early_cnt = 0;
+  sema_init (&sleeper.done, 0);
+  thread_create ("sleeper", PRI_DEFAULT, sleeper_thread, &sleeper);
+
+  msg ("Sleeping 10 seconds to let threads run, please wait...");
+  timer_sleep (10 * TIMER_FREQ);
+  sema_down (&sleeper.done);
+
+  for (i = 0; i < SPINNER_CNT; i++)
+    msg ("Spinner %d with nice %d received %d ticks.",
+         i, spinners[i].nice, spinners[i].tick_count);
+
+  /* Jain's fairness index of the two nice-0 spinners. */
+  a = spinners[0].tick_count;
+  b = spinners[1].tick_count;
+  msg ("Fairness among nice 0: %"PRId64"%%.",
+       a + b > 0 ? (a + b) * (a + b) * 100 / (2 * (a * a + b * b)) : 100);
+  msg ("Wakeup latency: %"PRId64" us avg, %"PRId64" us min, "
+       "%"PRId64" us max.", sleeper.total_ns / WAKEUP_CNT / 1000,
+       sleeper.min_ns / 1000, sleeper.max_ns / 1000);
+  msg ("Early wakeups: %d of %d.", sleeper.early_cnt, WAKEUP_CNT);
+}
+
+/* Spins from 1 s to 9 s after the start, counting ticks. */
+static void
+spinner_thread (void *s_) 
+{
+  struct spinner *s = s_;
+  int64_t sleep_time = 1 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + 8 * TIMER_FREQ;
+  int64_t last_time = 0;
+
+  /* The round-robin scheduler goes by priority alone. */
+  if (thread_mlfqs || thread_cfs)
+    thread_set_nice (s->nice);
+  timer_sleep (sleep_time - timer_elapsed (s->start_time));
+  while (timer_elapsed (s->start_time) < spin_time) 
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time != last_time)
+        s->tick_count++;
+      last_time = cur_time;
+    }
+}
+
+/* Sleeps SLEEP_NS at a time, starting 2 s after the start, and
+   records how late it wakes up, or how early. */
+static void
+sleeper_thread (void *s_) 
+{
+  struct sleeper *s = s_;
+  int i;
+
+  timer_sleep (2 * TIMER_FREQ - timer_elapsed (s->start_time));
+  for (i = 0; i < WAKEUP_CNT; i++) 
+    {
+      int64_t start = timer_nanoseconds ();
+      int64_t late;
+
+      timer_nsleep (SLEEP_NS);
+      late = timer_nanoseconds () - start - SLEEP_NS;
+      if (late < 0)
+        s->early_cnt++;
+      s->total_ns += late;
+      if (late < s->min_ns)
+        s->min_ns = late;
+      if (late > s->max_ns)
+        s->max_ns = late;
+    }
+  sema_up (&s->done);
+}
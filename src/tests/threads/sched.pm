@@ -0,0 +1,62 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks the output of a sched-bench test run with scheduling
+# POLICY.  Ticks and latencies vary from run to run, so what is
+# checked is how they compare: the two nice-0 spinners must be
+# treated fairly, the nice-aware policies must give the nice-5
+# spinner fewer ticks than either of them, and the sleeper must
+# never wake up early.  The rest must match exactly.
+sub check_sched_bench {
+    my ($policy) = @_;
+    our ($test);
+    my ($name) = $test;
+    $name =~ s%.*/%%;
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    my (@ticks);
+    for my $i (0...2) {
+	my ($line) = grep (/Spinner $i with nice \d+ received \d+ ticks\./,
+			   @output);
+	fail "No tick count reported for spinner $i.\n" if !defined $line;
+	($ticks[$i]) = $line =~ /received (\d+) ticks/;
+	fail "Spinner $i received no ticks.\n" if $ticks[$i] == 0;
+    }
+    if ($policy ne 'round-robin') {
+	fail "Spinner with nice 5 received $ticks[2] ticks, "
+	  . "not fewer than the nice-0 ones ($ticks[0] and $ticks[1]).\n"
+	  if $ticks[2] >= $ticks[0] || $ticks[2] >= $ticks[1];
+    }
+
+    # 90% still lets one nice-0 spinner have about 65% of the
+    # ticks the two of them got.
+    my ($min_fairness) = 90;
+    my ($fairness) = map (/Fairness among nice 0: (\d+)%\./, @output);
+    fail "No fairness index reported.\n" if !defined $fairness;
+    fail "Fairness among nice 0 is $fairness%, "
+      . "below $min_fairness%.\n" if $fairness < $min_fairness;
+
+    fail "No wakeup latency reported.\n"
+      if !grep (/Wakeup latency: -?\d+ us avg, -?\d+ us min, -?\d+ us max\./,
+		@output);
+    my ($early) = map (/Early wakeups: (\d+) of \d+\./, @output);
+    fail "No early wakeup count reported.\n" if !defined $early;
+    fail "Sleeper woke up early $early times.\n" if $early > 0;
+
+    @output = grep (!/Spinner \d|Fairness among|Wakeup latency|Early wakeups/,
+		    @output);
+    compare_output ("run", \@output, [<<EOF]);
+($name) begin
+($name) Scheduler: $policy.
+($name) Starting 3 spinners and 1 sleeper...
+($name) Sleeping 10 seconds to let threads run, please wait...
+($name) end
+EOF
+    pass;
+}
+
+1;
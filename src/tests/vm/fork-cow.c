@@ -0,0 +1,60 @@
+/* Forks a child that checks it sees the parent's data, then
+   overwrites all of it.  Writable pages are shared
+   copy-on-write after fork(), so the parent must still find its
+   own data afterward.  Some pages of the buffer were never
+   touched before fork(), and are first read in by the child. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGES 8
+#define TOUCHED 6               /* Pages written before fork(). */
+#define CHILD_OK 81
+
+static char buf[PAGES * PAGE_SIZE];
+
+/* Returns true if every byte of the first PAGES pages of buf
+   is C, and zero in the pages after them. */
+static bool
+holds (int pages, char c)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (i < (size_t) pages * PAGE_SIZE ? c : 0))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  int stack_data = 0x1234;
+  pid_t pid;
+  int status;
+
+  memset (buf, 'p', TOUCHED * PAGE_SIZE);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* Child: report through the exit code, as its output would
+         interleave with the parent's. */
+      if (!holds (TOUCHED, 'p') || stack_data != 0x1234)
+        exit (1);
+      memset (buf, 'c', sizeof buf);
+      stack_data = 0;
+      exit (holds (PAGES, 'c') ? CHILD_OK : 2);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  status = wait (pid);
+  CHECK (status == CHILD_OK, "child saw the parent's data and wrote its own");
+  CHECK (holds (TOUCHED, 'p') && stack_data == 0x1234,
+         "parent's data is unchanged");
+}
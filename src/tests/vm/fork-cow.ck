@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) fork
+fork-cow: exit(81)
+(fork-cow) child saw the parent's data and wrote its own
+(fork-cow) parent's data is unchanged
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
@@ -0,0 +1,61 @@
+/* Writes every page of a mapping that is larger than user
+   memory, which the kernel is limited to with -ul, so that the
+   dirty pages are evicted to swap.  Reads them back through the
+   mapping, which brings them in from swap, then unmaps the file
+   and verifies its contents with the read system call: pages
+   brought back from swap must still be written back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+static char buf[PAGE_SIZE];
+
+/* Returns the byte that page PAGE of the file is filled with. */
+static char
+page_byte (int page)
+{
+  return 'A' + page % 26;
+}
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  int page, i;
+
+  CHECK (create ("data", PAGE_CNT * PAGE_SIZE), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"data\"");
+
+  msg ("write %d pages through the mapping", PAGE_CNT);
+  for (page = 0; page < PAGE_CNT; page++)
+    for (i = 0; i < PAGE_SIZE; i++)
+      ACTUAL[page * PAGE_SIZE + i] = page_byte (page);
+
+  msg ("read them back through the mapping");
+  for (page = 0; page < PAGE_CNT; page++)
+    for (i = 0; i < PAGE_SIZE; i++)
+      if (ACTUAL[page * PAGE_SIZE + i] != page_byte (page))
+        fail ("byte %d of page %d is %d instead of %d before munmap",
+              i, page, ACTUAL[page * PAGE_SIZE + i], page_byte (page));
+
+  munmap (map);
+
+  msg ("read them back from the file");
+  for (page = 0; page < PAGE_CNT; page++)
+    {
+      if (read (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("read of page %d failed", page);
+      for (i = 0; i < PAGE_SIZE; i++)
+        if (buf[i] != page_byte (page))
+          fail ("byte %d of page %d is %d instead of %d after munmap",
+                i, page, buf[i], page_byte (page));
+    }
+  close (handle);
+}
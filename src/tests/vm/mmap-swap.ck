@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-swap) begin
+(mmap-swap) create "data"
+(mmap-swap) open "data"
+(mmap-swap) mmap "data"
+(mmap-swap) write 64 pages through the mapping
+(mmap-swap) read them back through the mapping
+(mmap-swap) read them back from the file
+(mmap-swap) end
+EOF
+pass;
@@ -0,0 +1,65 @@
+/* Sweeps working sets of growing size, from well inside user
+   memory to well beyond it, and verifies every page it touches.
+   Each sweep also keeps re-touching a small hot set, which page
+   replacement should keep resident.  The kernel's page fault
+   count at power off then gives the fault rate under this
+   memory pressure; run with different -ul and -wsclock options
+   to compare. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MAX_PAGES 768           /* 3 MB. */
+#define ROUNDS 3
+
+static char buf[MAX_PAGES * PAGE_SIZE];
+
+/* Returns the value page PAGE holds after ROUND of PHASE. */
+static uint32_t
+tag (int phase, int round, int page)
+{
+  return (uint32_t) page * 131 + round * 7 + phase * 1009;
+}
+
+/* Returns a pointer to the value kept in page PAGE. */
+static uint32_t *
+slot (int page)
+{
+  return (uint32_t *) (buf + page * PAGE_SIZE);
+}
+
+void
+test_main (void)
+{
+  static const int working_sets[] = { 128, 256, 512, 768 };
+  int phase;
+
+  for (phase = 0; phase < 4; phase++)
+    {
+      int pages = working_sets[phase];
+      int hot = pages / 8;
+      int round, page;
+
+      msg ("working set of %d pages, hot set of %d", pages, hot);
+      for (page = 0; page < pages; page++)
+        *slot (page) = tag (phase, 0, page);
+
+      for (round = 1; round <= ROUNDS; round++)
+        for (page = 0; page < pages; page++)
+          {
+            if (*slot (page) != tag (phase, round - 1, page))
+              fail ("page %d holds %"PRIu32" in round %d of phase %d",
+                    page, *slot (page), round, phase);
+            *slot (page) = tag (phase, round, page);
+
+            /* Hot pages below PAGE were already rewritten this
+               round. */
+            if (*slot (page % hot) != tag (phase, round, page % hot))
+              fail ("hot page %d lost in round %d of phase %d",
+                    page % hot, round, phase);
+          }
+    }
+}
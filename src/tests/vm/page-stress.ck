@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The fault count depends on memory size and replacement policy,
+# so only check that it was reported.
+fail "No page fault count reported.\n"
+  if !grep (/Exception: \d+ page faults/, @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-stress) begin
+(page-stress) working set of 128 pages, hot set of 16
+(page-stress) working set of 256 pages, hot set of 32
+(page-stress) working set of 512 pages, hot set of 64
+(page-stress) working set of 768 pages, hot set of 96
+(page-stress) end
+EOF
+pass;
@@ -0,0 +1,33 @@
+/* Sweeps a 1 MB buffer, four times the user memory that the
+   kernel is limited to with -ul, so that nearly every page
+   touched is read in from swap and later written back out.  The
+   kernel prints its swap I/O throughput at power off, and the
+   check for swap-bench-pio, which is booted with -pio, compares
+   it against that of swap-bench-dma. */
+
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 256            /* 1 MB. */
+#define PASSES 4
+
+static uint32_t buf[PAGE_CNT][PAGE_SIZE / sizeof (uint32_t)];
+
+void
+test_main (void)
+{
+  int pass, page;
+  size_t i;
+
+  msg ("sweep %d pages %d times", PAGE_CNT, PASSES);
+  for (pass = 0; pass < PASSES; pass++)
+    for (page = 0; page < PAGE_CNT; page++)
+      for (i = 0; i < PAGE_SIZE / sizeof (uint32_t); i++)
+        {
+          if (buf[page][i] != (uint32_t) (pass * PAGE_CNT + page))
+            fail ("word %zu of page %d is wrong on pass %d", i, page, pass);
+          buf[page][i]++;
+        }
+}
@@ -0,0 +1,53 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Returns the swap throughput, in kB/s, reported in OUTPUT, or
+# fails if there is none.
+sub swap_throughput {
+    my (@output) = @_;
+    for (@output) {
+	return $1
+	  if /^Swap: \d+ pages written, \d+ read in \d+ ms of I\/O, (\d+) kB\/s$/;
+    }
+    fail "No swap throughput reported.\n";
+}
+
+# Checks the output of a swap-bench test whose disks moved data
+# by MODE, "DMA" or "PIO": the disks must really have used MODE,
+# and the PIO run, which comes second, must not have swapped
+# faster than the DMA run did.
+sub check_swap_bench {
+    my ($mode) = @_;
+    our ($test);
+    my ($name) = $test;
+    $name =~ s%.*/%%;
+
+    my (@output) = read_text_file ("$test.output");
+    my ($kbps) = swap_throughput (@output);
+    fail "No sectors transferred by DMA.\n"
+      if $mode eq 'DMA' && !grep (/: [1-9]\d* sectors by DMA/, @output);
+    fail "Sectors transferred by DMA with -pio.\n"
+      if $mode eq 'PIO' && grep (/: [1-9]\d* sectors by DMA/, @output);
+
+    check_expected (IGNORE_EXIT_CODES => 1, [<<EOF]);
+($name) begin
+($name) sweep 256 pages 4 times
+($name) end
+EOF
+
+    if ($mode eq 'PIO') {
+	my ($dma_test) = $test;
+	$dma_test =~ s/-pio$/-dma/;
+	my ($dma_kbps) = swap_throughput (read_text_file ("$dma_test.output"));
+	my ($ratio) = $kbps > 0 ? sprintf ("%.2f", $dma_kbps / $kbps) : "inf";
+	print "Swap throughput: DMA $dma_kbps kB/s, PIO $kbps kB/s, "
+	  . "DMA/PIO $ratio.\n";
+	fail "Swapping by DMA was slower than by PIO.\n"
+	  if $dma_kbps < $kbps;
+    }
+    pass;
+}
+
+1;
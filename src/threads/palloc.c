@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -26,12 +27,25 @@
    half to the user pool.  That should be huge overkill for the
    kernel pool, but that's just fine for demonstration purposes. */
 
+/* Number of free pages per pool that the idle thread keeps
+   zeroed ahead of PAL_ZERO allocations. */
+#define ZEROED_PAGES 32
+
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+
+    /* Free pages already zeroed.  They are marked used in
+       used_map, and handed out from here instead.  Guarded by
+       disabling interrupts, as the idle thread may not block. */
+    void *zeroed[ZEROED_PAGES];
+    size_t zeroed_cnt;
+
+    long long zero_hits;                /* PAL_ZERO pages found zeroed. */
+    long long zero_misses;              /* PAL_ZERO pages zeroed inline. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,9 +53,14 @@ static struct pool kernel_pool, user_pool;
 
 static size_t user_pages;
 
+/* # of pages zeroed by the idle thread. */
+static long long idle_zeroed;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *take_zeroed_page (struct pool *);
+static bool release_zeroed_pages (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -75,6 +94,26 @@ get_userpool_base (void)
   return user_pool.base;
 }
 
+/* Returns the number of free pages in the user pool.  A page
+   the idle thread is zeroing is in neither the free map nor the
+   zeroed list, so the count may be one short; it only serves as
+   a watermark for paging out. */
+size_t
+get_free_user_pages (void)
+{
+  enum intr_level old_level;
+  size_t cnt;
+
+  lock_acquire (&user_pool.lock);
+  cnt = bitmap_count (user_pool.used_map, 0,
+                      bitmap_size (user_pool.used_map), false);
+  old_level = intr_disable ();
+  cnt += user_pool.zeroed_cnt;
+  intr_set_level (old_level);
+  lock_release (&user_pool.lock);
+  return cnt;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -91,19 +130,36 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      pages = take_zeroed_page (pool);
+      if (pages != NULL)
+        {
+          pool->zero_hits++;
+          return pages;
+        }
+    }
+
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
+  else if (page_cnt == 1)
+    pages = take_zeroed_page (pool);
+  else if (release_zeroed_pages (pool))
+    return palloc_get_multiple (flags, page_cnt);
   else
     pages = NULL;
 
   if (pages != NULL) 
     {
       if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+        {
+          memset (pages, 0, PGSIZE * page_cnt);
+          pool->zero_misses += page_cnt;
+        }
     }
   else 
     {
@@ -162,6 +218,94 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes a free page, and puts it on its pool's list of zeroed
+   pages.  Called by the idle thread, so it never blocks.
+   Returns false if there was nothing to zero, or if the pool
+   was busy. */
+bool
+palloc_zero_free_page (void)
+{
+  struct pool *pool;
+  enum intr_level old_level;
+  size_t page_idx;
+  void *page;
+
+  if (kernel_pool.zeroed_cnt < ZEROED_PAGES)
+    pool = &kernel_pool;
+  else if (user_pool.zeroed_cnt < ZEROED_PAGES)
+    pool = &user_pool;
+  else
+    return false;
+
+  /* Hold the lock with interrupts off, so that no thread can
+     start waiting for it, and donate its priority to the idle
+     thread, which only runs when no other thread is ready. */
+  old_level = intr_disable ();
+  if (!lock_try_acquire (&pool->lock))
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+  lock_release (&pool->lock);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  pool->zeroed[pool->zeroed_cnt++] = page;
+  idle_zeroed++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  printf ("Palloc: %lld pages zeroed while idle, "
+          "%lld kernel and %lld user zero page hits, %lld misses\n",
+          idle_zeroed, kernel_pool.zero_hits, user_pool.zero_hits,
+          kernel_pool.zero_misses + user_pool.zero_misses);
+}
+
+/* Takes a page off POOL's list of zeroed pages, or returns a
+   null pointer if it is empty. */
+static void *
+take_zeroed_page (struct pool *pool)
+{
+  enum intr_level old_level;
+  void *page = NULL;
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt > 0)
+    page = pool->zeroed[--pool->zeroed_cnt];
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Returns the pages on POOL's list of zeroed pages to its free
+   map, so that they can be part of a multiple-page allocation.
+   Returns false if there were none. */
+static bool
+release_zeroed_pages (struct pool *pool)
+{
+  void *page;
+  bool released = false;
+
+  while ((page = take_zeroed_page (pool)) != NULL)
+    {
+      lock_acquire (&pool->lock);
+      bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+      lock_release (&pool->lock);
+      released = true;
+    }
+  return released;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
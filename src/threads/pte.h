@@ -68,6 +68,7 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
 #define PTE_S 0x100             /* 1=page in swap, 0=not in swap (PTEs only) */
 #define PTE_PN 0x200             /* 1=pinned, 0=not pinned */
+#define PTE_COW 0x400           /* 1=copy-on-write, read-only until written */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -117,9 +118,28 @@ static inline bool pte_in_swap (uint32_t *pte) {
   return pte != NULL && (*pte & PTE_S) != 0;
 }
 
+/* Returns a not-present PTE for a page swapped out to SLOT,
+   keeping the flags of PTE.  The slot goes in the address bits,
+   which the CPU ignores while PTE_P is clear. */
+static inline uint32_t pte_create_swapped (uint32_t pte, size_t slot) {
+  ASSERT (slot <= PTE_ADDR >> PGBITS);
+  return (slot << PGBITS) | (pte & PTE_FLAGS & ~PTE_P) | PTE_S;
+}
+
+/* Returns the swap slot of PTE, which must be swapped out. */
+static inline size_t pte_get_swap_slot (uint32_t pte) {
+  return (pte & PTE_ADDR) >> PGBITS;
+}
+
 static inline bool pte_is_pinned (uint32_t *pte) {
   return pte != NULL && (*pte & PTE_PN) != 0;
 }
 
+/* Returns true if PTE maps a page shared copy-on-write by fork (),
+   which gets copied on its first write. */
+static inline bool pte_is_cow (uint32_t *pte) {
+  return pte != NULL && (*pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW);
+}
+
 #endif /* threads/pte.h */
 
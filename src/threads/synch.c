@@ -113,6 +113,7 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   int max_priority = -1;
+  bool preempt = false;
   /* Find the highest priority thread at retrieval as priorities can be updated */
   if (!list_empty (&sema->waiters)) {
     struct list_elem *it;
@@ -120,6 +121,7 @@ sema_up (struct semaphore *sema)
     struct thread *t;
     for (it = list_begin (&sema->waiters); it != list_end (&sema->waiters); it = list_next (it)) {
       t = list_entry (it, struct thread, elem);
+      if (thread_mlfqs) thread_mlfqs_refresh (t);
       if (t->priority > max_priority) {
         max_priority = t->priority;
         t_max = it;
@@ -129,12 +131,17 @@ sema_up (struct semaphore *sema)
     // printf("lock is released, waking up thread %s, %d with priority: %d, sema: %d, main prio: %d\n", t->name, t->tid, t->priority, sema->value, get_thread_by_tid (1)->priority);
     list_remove (t_max);
     thread_unblock(t);
+    /* deadline threads go by deadline, not priority */
+    if (t->dl_period != 0 || thread_current ()->dl_period != 0)
+      preempt = thread_preempts (t);
+    else
+      preempt = max_priority > thread_current ()->priority;
   }
 
   sema->value++;
   intr_set_level (old_level);
   // TODO: If sema_up is called within an interrupt, then thread shouldn't be yielded immediately
-  if (max_priority > thread_current ()->priority) {
+  if (preempt) {
     if (intr_context ()) {
       intr_yield_on_return ();
     } else {
@@ -379,3 +386,64 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes spinlock LOCK as released. */
+void
+spinlock_init (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  lock->locked = 0;
+}
+
+/* Acquires LOCK, spinning until it is released if another CPU
+   holds it.  Interrupts must be off.  The lock is not recursive:
+   acquiring it again before releasing it never returns. */
+void
+spinlock_acquire (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;)
+    {
+      int was_locked = 1;
+
+      /* xchg with a memory operand is atomic, and a full memory
+         barrier, without a lock prefix. */
+      asm volatile ("xchgl %0, %1"
+                    : "+r" (was_locked), "+m" (lock->locked)
+                    : : "memory");
+      if (!was_locked)
+        return;
+
+      /* Wait for it to look free before trying the bus-locking
+         xchg again. */
+      while (lock->locked)
+        asm volatile ("pause");
+    }
+}
+
+/* Releases LOCK, which must be held.  Interrupts must be off,
+   and are left off. */
+void
+spinlock_release (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (lock->locked);
+
+  /* A plain store releases on x86, once the compiler is kept
+     from moving the critical section's accesses after it. */
+  barrier ();
+  lock->locked = 0;
+}
+
+/* Returns true if LOCK is held, by any CPU. */
+bool
+spinlock_is_locked (const struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  return lock->locked != 0;
+}
@@ -41,6 +41,22 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Spinlock.  Guards state that more than one CPU may touch.  It
+   must be acquired with interrupts off, which is what excludes
+   other threads and interrupt handlers on the holder's own CPU;
+   the lock itself only excludes other CPUs.  A spinlock may be
+   held across a thread switch, and released by the thread
+   switched to, but must never be held while sleeping. */
+struct spinlock
+  {
+    volatile int locked;        /* 1 while held. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_is_locked (const struct spinlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -7,8 +7,10 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
 #ifdef USERPROG
@@ -20,16 +22,76 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running.  There is one
+   list per priority level, and bit P of ready_mask is set exactly
+   when ready_lists[P] is non-empty, so the highest priority ready
+   thread is found without walking any list.
+
+   The run queue is per CPU, along with the CPU's idle thread and
+   time slice, so that CPUs need not share scheduler state.  Only
+   the bootstrap processor is started, so there is a single one,
+   returned by this_rq ().  Its spinlock is held, with interrupts
+   off, whenever the ready lists are touched; schedule () is
+   entered with it held, and thread_schedule_tail () releases it
+   in the thread switched to. */
+struct runqueue
+  {
+    struct spinlock lock;               /* Guards ready_lists, ready_mask. */
+    struct list ready_lists[PRI_MAX + 1];
+    uint64_t ready_mask;
+    struct thread *idle_thread;         /* Runs when nothing is ready. */
+    unsigned thread_ticks;              /* # of timer ticks since last yield. */
+
+    /* cfs: ready threads ordered by vruntime, replacing the lists. */
+    struct rbtree cfs_tree;
+    unsigned long cfs_weight;           /* Sum of weights in cfs_tree. */
+    int64_t min_vruntime;               /* Never decreases. */
+    int64_t slice_start;                /* When the running thread got the CPU. */
+
+    /* Deadline class: ready threads with budget left, by absolute
+       deadline, which run ahead of every other thread. */
+    struct rbtree dl_tree;
+    struct list dl_throttled;           /* Out of budget, through `elem'. */
+  };
+
+static struct runqueue boot_rq;
+
+#if PRI_MAX >= 64
+#error ready_mask requires PRI_MAX < 64
+#endif
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Index of live threads by tid, for get_thread_by_tid ().  Tids
+   are handed out sequentially, so bucket TID % TID_BUCKETS holds
+   at most one thread unless more than TID_BUCKETS threads are
+   alive.  The buckets are static rather than a lib/kernel/hash.c
+   table because that one grows with malloc(), which is not usable
+   yet when the initial thread is registered, nor with interrupts
+   off in thread_exit(). */
+#define TID_BUCKETS 256
+static struct list tid_buckets[TID_BUCKETS];
+
+/* Sleeping threads, kept in a hierarchical timer wheel keyed on
+   wakeup_at.  Level 0 has one slot per tick for the next
+   SLEEP_WHEEL_SLOTS ticks; each higher level covers
+   SLEEP_WHEEL_SLOTS times the range of the one below, and its slots
+   are cascaded down one level when the level below wraps around.
+   A sleeping thread is linked into its slot through its `elem'
+   member, which is free while it's blocked.  Insertion is O(1) and
+   each tick only touches the threads that expire on it, plus an
+   amortized O(1) share of the cascades. */
+#define SLEEP_WHEEL_BITS 6
+#define SLEEP_WHEEL_SLOTS (1 << SLEEP_WHEEL_BITS)
+#define SLEEP_WHEEL_MASK (SLEEP_WHEEL_SLOTS - 1)
+#define SLEEP_WHEEL_LEVELS 4
+static struct list sleep_wheel[SLEEP_WHEEL_LEVELS][SLEEP_WHEEL_SLOTS];
+
+/* Next tick to be processed by thread_wakeup_sleepers (). */
+static int64_t sleep_wheel_next = 1;
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -52,30 +114,106 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
-static struct list multilevel_lists[PRI_MAX+1];
+/* If true, use the completely fair scheduler.
+   Controlled by kernel command-line option "-cfs". */
+bool thread_cfs;
+
+/* cfs gives every ready thread a turn within CFS_LATENCY, split in
+   proportion to weight, but no turn shorter than CFS_MIN_SLICE, so
+   the period stretches with many threads.  A woken thread preempts
+   the running one only if it's behind by more than CFS_WAKEUP_GRAN,
+   and a sleeper is credited at most half a period on wakeup.  Turns
+   end on a timer tick, so a slice below one tick lasts one tick.
+   All in nanoseconds. */
+#define CFS_LATENCY (40 * 1000 * 1000)
+#define CFS_MIN_SLICE (5 * 1000 * 1000)
+#define CFS_WAKEUP_GRAN (5 * 1000 * 1000)
+
+/* The deadline class runs, earliest deadline first, threads that
+   declared through thread_set_deadline() that they need a runtime
+   in every period, by a deadline.  Each one is held to its runtime
+   (constant bandwidth server): one that runs out is throttled until
+   its next period, checked at each timer tick, and one that wakes
+   up too close to its deadline to use the rest of its budget gets
+   a new deadline instead.  Admission control keeps the sum of
+   runtime / period of all such threads within DL_BW_LIMIT, so that
+   their deadlines can all be met and the other classes keep a
+   share.  Bandwidths are fixed point with DL_BW_SHIFT bits, and
+   periods are limited to DL_PERIOD_MAX ns so that products of two
+   times fit in 64 bits. */
+#define DL_BW_SHIFT 20
+#define DL_BW_LIMIT ((95 << DL_BW_SHIFT) / 100)
+#define DL_PERIOD_MAX ((int64_t) 1000 * 1000 * 1000)
+static int64_t dl_total_bw;             /* Sum of admitted bandwidths. */
+
+/* Weight of each nice value from -20 to 20, each ~1.25 times the
+   next, so that one nice step is worth about 10% of the CPU. */
+#define CFS_NICE_0_WEIGHT 1024
+static const unsigned long cfs_weights[41] = {
+  88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+  9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+  1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+  110, 87, 70, 56, 45, 36, 29, 23, 18, 15, 12
+};
 
 /* initialized to 0 */
 static int ready_threads = 0;
 static fxpoint load_average = 0;
 
+/* mlfqs decays the recent_cpu of every thread once per second.
+   Instead of walking all threads in the timer interrupt, the load
+   average used by each decay is recorded in a ring, and a thread
+   applies the decays it missed whenever it's next looked at (when
+   it's enqueued, dequeued or woken up).  A bounded sweep over
+   all_list on every tick keeps the lag of any thread well within
+   the ring. */
+#define DECAY_HISTORY 64
+static fxpoint decay_load_avg[DECAY_HISTORY];
+static int64_t decay_epoch;             /* # of decays so far. */
+
+/* # of threads brought up to date by each step of the sweep. */
+#define REFRESH_BATCH 8
+static struct list_elem *refresh_cursor;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
-static struct thread *next_thread_to_run (struct thread *);
+static struct runqueue *this_rq (void);
+static struct thread *next_thread_to_run (struct runqueue *);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push_back (struct runqueue *, struct thread *);
+static void ready_push_front (struct runqueue *, struct thread *);
+static void ready_remove (struct runqueue *, struct thread *);
+static void ready_requeue (struct runqueue *, struct thread *, int priority,
+                           bool front);
+static int ready_max_priority (struct runqueue *);
+static unsigned long cfs_weight (const struct thread *);
+static bool cfs_less (const struct rbtree_elem *, const struct rbtree_elem *,
+                      void *aux UNUSED);
+static void cfs_update_curr (struct runqueue *);
+static int64_t cfs_slice (struct runqueue *, const struct thread *);
+static bool thread_is_dl (const struct thread *);
+static bool dl_less (const struct rbtree_elem *, const struct rbtree_elem *,
+                     void *aux UNUSED);
+static void dl_update_curr (void);
+static void dl_replenish (struct runqueue *);
+static void requeue_with_priority (struct thread *, int priority);
+static void mlfqs_decay (struct thread *);
+static void tid_table_insert (struct thread *);
+static void sleep_wheel_insert (struct thread *);
+static int sleep_wheel_cascade (int level);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -96,12 +234,24 @@ thread_init (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
   list_init (&all_list);
 
-  if (thread_mlfqs) {
-    for (int i = 0; i <= PRI_MAX; i++) {
-      list_init (&multilevel_lists[i]);
+  for (int i = 0; i < TID_BUCKETS; i++) {
+    list_init (&tid_buckets[i]);
+  }
+
+  spinlock_init (&boot_rq.lock);
+  for (int i = PRI_MIN; i <= PRI_MAX; i++) {
+    list_init (&boot_rq.ready_lists[i]);
+  }
+  boot_rq.ready_mask = 0;
+  rbtree_init (&boot_rq.cfs_tree, cfs_less, NULL);
+  rbtree_init (&boot_rq.dl_tree, dl_less, NULL);
+  list_init (&boot_rq.dl_throttled);
+
+  for (int level = 0; level < SLEEP_WHEEL_LEVELS; level++) {
+    for (int i = 0; i < SLEEP_WHEEL_SLOTS; i++) {
+      list_init (&sleep_wheel[level][i]);
     }
   }
 
@@ -110,6 +260,7 @@ thread_init (void)
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  tid_table_insert (initial_thread);
   ready_threads = 1;
   // printf("First thread: %s, %d\n", initial_thread->name, initial_thread->tid);
 }
@@ -138,10 +289,11 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct runqueue *rq = this_rq ();
   // printf("Thread tick for: %d at tick: %d\n", t->tid, timer_ticks ());
 
   /* Update statistics. */
-  if (t == idle_thread)
+  if (t == rq->idle_thread)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
@@ -150,9 +302,23 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  /* Enforce preemption.  Deadline threads aren't time sliced, but
+   * held to their budget. */
+  dl_replenish (rq);
+  if (thread_is_dl (t)) {
+    dl_update_curr ();
+    if (t->dl_budget <= 0) {
+      t->dl_throttled = true;
+      intr_yield_on_return ();
+    }
+  } else if (thread_cfs) {
+    if (t == rq->idle_thread || rbtree_empty (&rq->cfs_tree)) return;
+    cfs_update_curr (rq);
+    if (t->exec_start - rq->slice_start >= cfs_slice (rq, t))
+      intr_yield_on_return ();
+  } else if (++rq->thread_ticks >= TIME_SLICE) {
     intr_yield_on_return ();
+  }
 }
 
 /* Prints thread statistics. */
@@ -198,6 +364,7 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  tid_table_insert (t);
   // printf("Thread with name, tid, priority %s, %d, %d\n", t->name, tid, t->priority);
 
   /* only after tid is allocated, update the nice values
@@ -218,7 +385,13 @@ thread_create (const char *name, int priority,
       t->actual_priority = t->priority;
     }
 
-    sema_init (&t->child_sema, 0);
+    /* a new thread starts just behind the others, so that forking
+     * can't be used to get ahead */
+    if (thread_cfs) {
+      t->nice = cur->nice;
+      t->vruntime = this_rq ()->min_vruntime + CFS_MIN_SLICE;
+    }
+
     t->open_fds = 0;
     for (int i = 0; i < MAX_OPEN_FD; i++) t->file_descriptors[i] = NULL;
   }
@@ -268,9 +441,9 @@ reset_donated_priority (struct thread *cur)
     t = get_thread_by_tid (tid);
     t->donations_held--;
     if (t->donations_held <= 0) {
-      t->priority = t->actual_priority;
+      requeue_with_priority (t, t->actual_priority);
     } else {
-      t->priority = cur->donated_priority[i];
+      requeue_with_priority (t, cur->donated_priority[i]);
     }
     cur->donated_priority[i] = -1;
     cur->donated_to[i] = -1;
@@ -305,7 +478,7 @@ donate_priority (struct thread *cur, struct thread *holder, struct lock *l)
   cur->donated_to[0] = holder->tid;
   cur->donated_priority[0] = holder_priority;
 
-  holder->priority = cur_priority;
+  requeue_with_priority (holder, cur_priority);
   holder->donations_held += 1;
 
   // printf("yielding from %d to %d, ticks: %d, priorities c: %d, old: %d, new: %d, at: %d\n", cur->tid, holder->tid, thread_ticks, cur_priority, holder_priority, holder->priority, timer_ticks ());
@@ -326,7 +499,7 @@ donate_priority (struct thread *cur, struct thread *holder, struct lock *l)
       cur->donated_to[i+1] = tid;
       cur->donated_priority[i+1] = t->priority;
 
-      t->priority = cur_priority;
+      requeue_with_priority (t, cur_priority);
       t->donations_held++;
     }
 
@@ -342,24 +515,32 @@ priority_schedule (struct thread *cur, struct thread *t)
 {
   enum intr_level old_level;
   old_level = intr_disable ();
-  if (cur->priority < t->priority) {
+  if (thread_cfs ? thread_preempts (t) : cur->priority < t->priority) {
     ASSERT (!intr_context ());
     thread_yield ();
   }
   intr_set_level (old_level);
 }
 
+/* Sleeping threads are blocked, so they stay off the run queue
+ * until thread_wakeup_sleepers () unblocks them from the timer interrupt */
 void
 thread_make_sleep (int64_t new_wakeup_at)
 {
+  ASSERT (!intr_context ());
   enum intr_level old_level = intr_disable ();
+  /* every tick up to timer_ticks () has been processed already */
+  if (new_wakeup_at < sleep_wheel_next) {
+    intr_set_level (old_level);
+    return;
+  }
+
   struct thread *cur = thread_current ();
   cur->wakeup_at = new_wakeup_at;
   cur->sleeping = true;
-  ready_threads--;
+  sleep_wheel_insert (cur);
+  thread_block ();
   intr_set_level (old_level);
-  ASSERT (!intr_context ());
-  thread_yield ();
 }
 
 void
@@ -368,36 +549,146 @@ thread_wakeup (struct thread *t)
   ASSERT (intr_get_level () == INTR_OFF);
   t->wakeup_at = -1;
   t->sleeping = false;
-  ready_threads++;
+  thread_unblock (t);
 }
 
-/* Iterates through all_list to wakeup sleeping threads during scheduling
- * An additional list should be utilised to maintain sleeping threads
- *   - better performance
- *   - cleaner code
-*/
+/* Adds sleeping thread T to the slot of the sleep wheel that
+   covers its wakeup_at, relative to the next tick to process.
+   Wakeups too far out for the top level are parked in its last
+   slot and re-inserted when they get cascaded. */
 static void
-wakeup_threads (void)
+sleep_wheel_insert (struct thread *t)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  struct list_elem *it;
-  struct thread *t;
-  for (it = list_begin (&all_list); it != list_end (&all_list); it = list_next (it)) {
-    t = list_entry (it, struct thread, allelem);
-    if (t->sleeping && t->wakeup_at <= timer_ticks ()) thread_wakeup (t);
+  ASSERT (t->sleeping);
+
+  int64_t expires = t->wakeup_at;
+  int64_t delta = expires - sleep_wheel_next;
+  int level;
+
+  if (delta < 0)
+    expires = sleep_wheel_next;
+  for (level = 0; level < SLEEP_WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (SLEEP_WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (SLEEP_WHEEL_BITS * SLEEP_WHEEL_LEVELS))
+    expires = sleep_wheel_next + ((int64_t) 1 << (SLEEP_WHEEL_BITS * SLEEP_WHEEL_LEVELS)) - 1;
+
+  int slot = (expires >> (SLEEP_WHEEL_BITS * level)) & SLEEP_WHEEL_MASK;
+  list_push_back (&sleep_wheel[level][slot], &t->elem);
+}
+
+/* Moves every thread in the current slot of LEVEL down to the
+   levels below it, and returns that slot's index, which is 0 when
+   LEVEL has wrapped around and the level above must cascade too. */
+static int
+sleep_wheel_cascade (int level)
+{
+  int slot = (sleep_wheel_next >> (SLEEP_WHEEL_BITS * level)) & SLEEP_WHEEL_MASK;
+  struct list *bucket = &sleep_wheel[level][slot];
+  struct list pending;
+
+  /* Detach the whole slot first, since a thread may land back in it */
+  list_init (&pending);
+  if (!list_empty (bucket))
+    list_splice (list_end (&pending), list_begin (bucket), list_end (bucket));
+
+  while (!list_empty (&pending)) {
+    struct thread *t = list_entry (list_pop_front (&pending), struct thread, elem);
+    sleep_wheel_insert (t);
   }
+  return slot;
 }
 
-/* fetch a thread from all_list -> useful for priority donation. Is this safe? */
+/* Wakes up every sleeping thread whose wakeup_at is at or before
+ * NOW.  Called by the timer interrupt handler at each tick, so only
+ * threads that actually expire are touched.  Requests a yield on
+ * return if a woken thread should preempt the running one */
+void
+thread_wakeup_sleepers (int64_t now)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  bool preempt = false;
+
+  while (sleep_wheel_next <= now) {
+    int slot = sleep_wheel_next & SLEEP_WHEEL_MASK;
+    for (int level = 1; slot == 0 && level < SLEEP_WHEEL_LEVELS; level++) {
+      if (sleep_wheel_cascade (level) != 0) break;
+    }
+
+    struct list *bucket = &sleep_wheel[0][slot];
+    while (!list_empty (bucket)) {
+      struct thread *t = list_entry (list_pop_front (bucket), struct thread, elem);
+      ASSERT (t->wakeup_at <= sleep_wheel_next);
+      thread_wakeup (t);
+      if (thread_preempts (t)) preempt = true;
+    }
+    sleep_wheel_next++;
+  }
+
+  if (preempt && intr_context ()) intr_yield_on_return ();
+}
+
+/* Returns true if T, just woken up, should run before the running
+ * thread: it has a higher priority, or only the idle thread runs */
+bool
+thread_preempts (const struct thread *t)
+{
+  struct thread *cur = thread_current ();
+  if (cur == this_rq ()->idle_thread) return true;
+  if (thread_is_dl (t) || thread_is_dl (cur))
+    return thread_is_dl (t) && (!thread_is_dl (cur) || t->dl_abs_deadline < cur->dl_abs_deadline);
+  if (thread_cfs) return t->vruntime + CFS_WAKEUP_GRAN < cur->vruntime;
+  return t->priority > cur->priority;
+}
+
+/* Returns the first tick, no later than LIMIT, at which
+ * thread_wakeup_sleepers () has something to do: wake a thread, or
+ * cascade the wheel, which may bring a thread due on that same tick.
+ * Returns LIMIT if there is none.  Used to stop the tick while idle */
+int64_t
+thread_next_wakeup (int64_t limit)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* throttled deadline threads are replenished on the tick */
+  if (!list_empty (&this_rq ()->dl_throttled)) return sleep_wheel_next;
+
+  for (int64_t t = sleep_wheel_next; t < limit; t++) {
+    int slot = t & SLEEP_WHEEL_MASK;
+    if (slot == 0 || !list_empty (&sleep_wheel[0][slot])) return t;
+  }
+  return limit;
+}
+
+/* Adds T, whose tid has just been allocated, to the tid index.
+ * Removed by thread_exit () along with the all_list entry */
+static void
+tid_table_insert (struct thread *t)
+{
+  ASSERT (t->tid != TID_ERROR);
+  enum intr_level old_level = intr_disable ();
+  list_push_back (&tid_buckets[t->tid % TID_BUCKETS], &t->tidelem);
+  intr_set_level (old_level);
+}
+
+/* fetch a live thread by tid -> useful for priority donation.
+ * Interrupts are only disabled while the tid's own bucket is
+ * scanned, which is a single entry unless tids have wrapped around
+ * the table while older threads are still alive */
 struct thread *
 get_thread_by_tid (int tid)
 {
   struct list_elem *e;
   struct thread *t;
-  enum intr_level old_level = intr_disable ();
+  struct list *bucket;
+
+  if (tid < 0) return NULL;
+  bucket = &tid_buckets[tid % TID_BUCKETS];
 
-  for(e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e)) {
-    t = list_entry (e, struct thread, allelem);
+  enum intr_level old_level = intr_disable ();
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) {
+    t = list_entry (e, struct thread, tidelem);
     if (t->tid == tid) {
       intr_set_level (old_level);
       return t;
@@ -408,7 +699,7 @@ get_thread_by_tid (int tid)
   return NULL;
 }
 
-/* fetch a thread from alllist by pid */
+/* fetch a thread from the tid index by pid */
 struct thread *
 get_thread_by_pid (pid_t pid)
 {
@@ -432,6 +723,7 @@ thread_block (void)
   struct thread *cur = thread_current ();
   cur->status = THREAD_BLOCKED;
   if (cur->tid != 2) ready_threads--;
+  spinlock_acquire (&this_rq ()->lock);
   schedule ();
 }
 
@@ -446,6 +738,7 @@ thread_block (void)
 void
 thread_unblock (struct thread *t) 
 {
+  struct runqueue *rq = this_rq ();
   enum intr_level old_level;
 
   ASSERT (is_thread (t));
@@ -454,19 +747,33 @@ thread_unblock (struct thread *t)
   ASSERT (t->status == THREAD_BLOCKED);
 
   if (t->tid != 2) ready_threads++;
-  if (thread_mlfqs) {
-    list_push_back (&multilevel_lists[t->priority], &t->elem);
-  } else {
-    if (t->donations_made > 0) {
-      // TODO: this appears to be a hacky way - need to compare the lock/sema as well
-      // If this is not done, then a donee thread will get scheduled despite having a lower actual priority
-      // however, the donee thread can't reset its priority after releasing the lock as it maybe holding other locks
-      list_push_front (&ready_list, &t->elem);
-    } else {
-      list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs) thread_mlfqs_refresh (t);
+  spinlock_acquire (&rq->lock);
+  /* a sleeper catches up on the time it missed, minus a small credit */
+  if (thread_cfs && t->vruntime < rq->min_vruntime - CFS_LATENCY / 2)
+    t->vruntime = rq->min_vruntime - CFS_LATENCY / 2;
+  /* a deadline thread that can't use the rest of its budget by its
+   * deadline without going over its bandwidth starts a new job */
+  if (thread_is_dl (t) && !t->dl_throttled) {
+    int64_t now = timer_nanoseconds ();
+    if (t->dl_abs_deadline <= now
+        || t->dl_budget * t->dl_period > (t->dl_abs_deadline - now) * t->dl_runtime) {
+      t->dl_abs_deadline = now + t->dl_deadline;
+      t->dl_budget = t->dl_runtime;
+    } else if (t->dl_budget <= 0) {
+      t->dl_throttled = true;
     }
   }
+  if (!thread_mlfqs && t->donations_made > 0) {
+    // TODO: this appears to be a hacky way - need to compare the lock/sema as well
+    // If this is not done, then a donee thread will get scheduled despite having a lower actual priority
+    // however, the donee thread can't reset its priority after releasing the lock as it maybe holding other locks
+    ready_push_front (rq, t);
+  } else {
+    ready_push_back (rq, t);
+  }
   t->status = THREAD_READY;
+  spinlock_release (&rq->lock);
   intr_set_level (old_level);
 }
 
@@ -516,46 +823,48 @@ thread_exit (void)
   process_exit ();
 #endif
 
-  /* Remove thread from all threads list, set our status to dying,
-     and schedule another process.  That process will destroy us
-     when it calls thread_schedule_tail(). */
-  intr_disable ();
   struct thread *cur = thread_current ();
-  list_remove (&cur->allelem);
-
   if (cur->user_thread) {
     if (cur->exit_status == -2) cur->exit_status = -1;
     printf("%s: exit(%d)\n", cur->name, cur->exit_status);
+  }
 
-    update_exit_status_for_parent ();
+  /* Publish the exit status and wake a parent blocked in
+     process_wait ().  Done before interrupts go off since the
+     records are freed with free (). */
+  if (cur->child_record != NULL) {
+    cur->child_record->exit_status = cur->exit_status;
+    sema_up (&cur->child_record->exit_sema);
+    thread_release_child (cur->child_record);
+    cur->child_record = NULL;
   }
+  while (!list_empty (&cur->children))
+    thread_release_child (list_entry (list_pop_front (&cur->children),
+                                      struct child, elem));
+
+  /* Remove thread from all threads list, set our status to dying,
+     and schedule another process.  That process will destroy us
+     when it calls thread_schedule_tail(). */
+  intr_disable ();
+  if (refresh_cursor == &cur->allelem)
+    refresh_cursor = list_next (refresh_cursor);
+  list_remove (&cur->allelem);
+  list_remove (&cur->tidelem);
 
   file_close (cur->exfile);
+  if (thread_is_dl (cur))
+    dl_total_bw -= (cur->dl_runtime << DL_BW_SHIFT) / cur->dl_period;
   cur->status = THREAD_DYING;
   ready_threads--;
+  spinlock_acquire (&this_rq ()->lock);
   schedule ();
   NOT_REACHED ();
 }
 
-void
-update_exit_status_for_parent (void)
-{
-  struct thread *cur = thread_current ();
-  struct thread *parent = get_thread_by_pid (cur->parent_pid);
-  if (is_thread (parent)) {
-    for (int i = 0; i < parent->child_threads; i++) {
-      if (parent->t_children[i].pid == cur->pid) {
-        parent->t_children[i].exit_status = cur->exit_status;
-        break;
-      }
-    }
-  }
-}
-
 uint64_t
 total_ticks (void)
 {
-  return (idle_ticks + kernel_ticks + user_ticks + thread_ticks);
+  return (idle_ticks + kernel_ticks + user_ticks + this_rq ()->thread_ticks);
 }
 
 /* Yields the CPU.  The current thread is not put to sleep and
@@ -564,19 +873,16 @@ void
 thread_yield (void) 
 {
   struct thread *cur = thread_current ();
+  struct runqueue *rq = this_rq ();
   enum intr_level old_level;
   
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    if (thread_mlfqs) {
-      int priority = cur->priority;
-      list_push_back (&multilevel_lists[priority], &cur->elem);
-    } else {
-      list_push_back (&ready_list, &cur->elem);
-    }
-  }
+  if (thread_mlfqs) thread_mlfqs_refresh (cur);
+  spinlock_acquire (&rq->lock);
+  if (thread_cfs && cur != rq->idle_thread && !thread_is_dl (cur)) cfs_update_curr (rq);
+  if (cur != rq->idle_thread) ready_push_back (rq, cur);
   cur->status = THREAD_READY;
   schedule ();
   // printf("yield() for %d, at: %d, wake: %lld\n", cur->tid, timer_ticks (), cur->wakeup_at);
@@ -624,19 +930,12 @@ thread_set_priority (int new_priority)
   if (new_priority >= old_priority) {
     return;
   }
+  struct runqueue *rq = this_rq ();
   enum intr_level old_level;
   old_level = intr_disable ();
-  struct list_elem *e;
-  bool yield = false;
-  struct thread *t;
-
-  for (e = list_begin (&ready_list); e != list_end (&ready_list); e = list_next (e)) {
-    t = list_entry (e, struct thread, elem);
-    if (t->priority > new_priority && t->status == THREAD_READY && t->sleeping == false) {
-        yield = true;
-        break;
-    }
-  } 
+  spinlock_acquire (&rq->lock);
+  bool yield = ready_max_priority (rq) > new_priority;
+  spinlock_release (&rq->lock);
   intr_set_level (old_level);
   // yield the thread, method disables the interrupt - should this be inside the above block?
   if (yield == true) {
@@ -645,6 +944,57 @@ thread_set_priority (int new_priority)
   }
 }
 
+/* Puts the current thread in the deadline class: it needs RUNTIME
+ * ns of CPU time in every PERIOD ns, within DEADLINE ns of the start
+ * of the period.  Returns false, and changes nothing, if the values
+ * don't make sense or admitting the thread would overload the class.
+ * All three 0 takes the thread back out of the class */
+bool
+thread_set_deadline (int64_t runtime, int64_t period, int64_t deadline)
+{
+  struct thread *cur = thread_current ();
+  struct runqueue *rq = this_rq ();
+  int64_t bw = 0;
+  int64_t old_bw = 0;
+  enum intr_level old_level;
+
+  if (period == 0) {
+    if (runtime != 0 || deadline != 0) return false;
+  } else if (runtime <= 0 || runtime > deadline || deadline > period
+             || period > DL_PERIOD_MAX) {
+    return false;
+  } else {
+    bw = (runtime << DL_BW_SHIFT) / period;
+  }
+
+  old_level = intr_disable ();
+  if (thread_is_dl (cur)) old_bw = (cur->dl_runtime << DL_BW_SHIFT) / cur->dl_period;
+  if (dl_total_bw - old_bw + bw > DL_BW_LIMIT) {
+    intr_set_level (old_level);
+    return false;
+  }
+  dl_total_bw += bw - old_bw;
+
+  int64_t now = timer_nanoseconds ();
+  cur->dl_runtime = runtime;
+  cur->dl_period = period;
+  cur->dl_deadline = deadline;
+  cur->dl_abs_deadline = now + deadline;
+  cur->dl_budget = runtime;
+  cur->dl_exec_start = now;
+  cur->dl_throttled = false;
+  /* back in cfs, don't make up for the time spent outside it */
+  if (period == 0 && thread_cfs) {
+    if (cur->vruntime < rq->min_vruntime) cur->vruntime = rq->min_vruntime;
+    cur->exec_start = now;
+  }
+  intr_set_level (old_level);
+
+  /* let a thread that now comes first run */
+  thread_yield ();
+  return true;
+}
+
 /* Returns the current thread's priority. */
 int
 thread_get_priority (void) 
@@ -652,41 +1002,15 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* To update the priorities, start with highest priority threads
- * This ensures round robin orders are maintained
- * Additional variables can be used to prevent recomputation
-*/
+/* Only the running thread's recent_cpu changes between two
+ * decays, so it's the only one whose priority needs recomputing
+ * every 4 ticks. */
 void
-thread_update_all_priorities (void)
+thread_update_priority (void)
 {
-  enum intr_level old_level = intr_disable ();
-  struct list_elem *it;
-  struct list_elem *t_it;
-  struct list *tlist;
-  struct thread *t;
-  for (int i = PRI_MAX; i >= 0; i--) {
-    tlist = &multilevel_lists[i];
-    if (list_size (tlist) > 0) {
-      for (it = list_begin (tlist); it != list_end (tlist); it = list_next (it)) {
-        t = list_entry (it, struct thread, elem);
-        int old_priority = t->priority;
-        t->priority = calculate_priority (t->recent_cpu, t->nice);
-        if (t->priority != old_priority) {
-          t_it = list_prev (it);
-          list_remove (&t->elem);
-          list_push_back (&multilevel_lists[t->priority], &t->elem);
-          it = t_it;
-        }
-      }
-    }
-  }
-
-  for (it = list_begin (&all_list); it != list_end (&all_list); it = list_next (it)) {
-    t = list_entry (it, struct thread, allelem);
-    if (t == idle_thread || t->status == THREAD_READY) continue;
-    t->priority = calculate_priority (t->recent_cpu, t->nice);
-  }
-  intr_set_level (old_level);
+  ASSERT (intr_get_level () == INTR_OFF);
+  struct thread *cur = thread_current ();
+  if (cur != this_rq ()->idle_thread) cur->priority = calculate_priority (cur->recent_cpu, cur->nice);
 }
 
 /* for debugging */
@@ -694,7 +1018,7 @@ void
 print_all_priorities (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  if (thread_current () == idle_thread) return;
+  if (thread_current () == this_rq ()->idle_thread) return;
   struct list_elem *it;
   struct thread *t;
   printf("Printing thread state at: %lld\n", timer_ticks ());
@@ -710,6 +1034,8 @@ thread_set_nice (int new_nice)
 {
   enum intr_level old_level = intr_disable ();
   struct thread *cur = thread_current ();
+  /* charge the time run so far at the old weight */
+  if (thread_cfs && cur != this_rq ()->idle_thread) cfs_update_curr (this_rq ());
   if (new_nice > 20) {
     cur->nice = 20;
   } else if (new_nice < -20) {
@@ -717,6 +1043,13 @@ thread_set_nice (int new_nice)
   } else {
     cur->nice = new_nice;
   }
+  /* the new weight applies from here on - let a thread that is now
+   * further behind run */
+  if (thread_cfs) {
+    intr_set_level (old_level);
+    thread_yield ();
+    return;
+  }
   int old_priority = cur->priority;
   // current thread not in ready list
   cur->priority = calculate_priority (cur->recent_cpu, cur->nice);
@@ -754,66 +1087,110 @@ thread_get_recent_cpu (void)
   return fxtoi_nearest (mult_fxpoint_int (thread_current ()->recent_cpu, 100));
 }
 
-/* Setting of recent cpu doesn't lead to a change in priority
- * no shuffling required - hence, iterate over the all_list
-*/ 
-void thread_update_all_recent_cpu (void)
+/* Records a decay of recent_cpu with the current load average.
+ * Other threads pick it up lazily; the running thread applies it
+ * right away, before its recent_cpu is incremented again. */
+void
+thread_decay_recent_cpu (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  struct list_elem *it;
-  struct thread *t;
-  for (it = list_begin (&all_list); it != list_end (&all_list); it = list_next (it)) {
-    t = list_entry (it, struct thread, allelem);
-    if (t == idle_thread) continue;
-    thread_set_recent_cpu (t);
-  }
+  decay_load_avg[decay_epoch % DECAY_HISTORY] = load_average;
+  decay_epoch++;
+  thread_mlfqs_refresh (thread_current ());
 }
 
 void
 thread_recent_cpu_tick (void)
 {
   struct thread *cur = thread_current ();
-  if (cur != idle_thread) cur->recent_cpu = add_fxpoint (cur->recent_cpu, F_FXPOINT);
+  if (cur != this_rq ()->idle_thread) cur->recent_cpu = add_fxpoint (cur->recent_cpu, F_FXPOINT);
 }
 
+/* Applies the decays of recent_cpu that T has missed.  If T lags
+   by more than the history kept, the oldest recorded load average
+   stands in for the ones that were overwritten. */
+static void
+mlfqs_decay (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  while (t->decay_epoch < decay_epoch) {
+    int64_t epoch = t->decay_epoch;
+    if (decay_epoch - epoch > DECAY_HISTORY) epoch = decay_epoch - DECAY_HISTORY;
+    t->recent_cpu = calculate_recent_cpu (t->recent_cpu, decay_load_avg[epoch % DECAY_HISTORY], t->nice);
+    t->decay_epoch++;
+  }
+}
+
+/* Brings T's recent_cpu and priority up to date.  A thread in the
+ * run queue is moved to the back of its new bucket if its priority
+ * changes, as the full recomputation used to do. */
 void
-thread_set_recent_cpu (struct thread *t)
+thread_mlfqs_refresh (struct thread *t)
 {
-  t->recent_cpu = calculate_recent_cpu (t->recent_cpu, load_average, t->nice);
+  struct runqueue *rq = this_rq ();
+
+  ASSERT (thread_mlfqs);
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (t == rq->idle_thread) return;
+
+  mlfqs_decay (t);
+  int priority = calculate_priority (t->recent_cpu, t->nice);
+  if (t->status == THREAD_READY && t->priority != priority) {
+    spinlock_acquire (&rq->lock);
+    ready_requeue (rq, t, priority, false);
+    spinlock_release (&rq->lock);
+  } else {
+    t->priority = priority;
+  }
 }
 
-/* this method finds if pid is child of t, and gets its index if found
- * removes it from the list of exited processes and reduces child thread count
- * since a process thread is single, no locking should be required */
-int
-fetch_child_exit_status (pid_t pid)
+/* Called on every tick.  Refreshes up to REFRESH_BATCH threads
+ * that have missed a decay, resuming where the last call stopped */
+void
+thread_refresh_priorities (void)
 {
-  enum intr_level old_level = intr_disable ();
-  struct thread *cur = thread_current ();
-  if (cur->child_threads < 1) {
-    intr_set_level (old_level);
-    return -1;
+  ASSERT (intr_get_level () == INTR_OFF);
+  struct thread *t;
+
+  for (int i = 0; i < REFRESH_BATCH; i++) {
+    if (refresh_cursor == NULL || refresh_cursor == list_end (&all_list))
+      refresh_cursor = list_begin (&all_list);
+    if (refresh_cursor == list_end (&all_list)) break;
+
+    t = list_entry (refresh_cursor, struct thread, allelem);
+    refresh_cursor = list_next (refresh_cursor);
+    if (t != this_rq ()->idle_thread && t->decay_epoch != decay_epoch) thread_mlfqs_refresh (t);
   }
+}
 
-  for (int i = 0; i < cur->child_threads; i++) {
-    if (cur->t_children[i].pid == pid) {
-      int exit_status = cur->t_children[i].exit_status;
-      if (exit_status != -2) {
-        if (cur->child_threads == 1) {
-          cur->t_children[i].pid = 0;
-          cur->t_children[i].exit_status = -2;
-        } else {
-          cur->t_children[i].pid = cur->t_children[cur->child_threads-1].pid;
-          cur->t_children[i].exit_status = cur->t_children[cur->child_threads-1].exit_status;
-        }
-        cur->child_threads--;
-      }
-      intr_set_level (old_level);
-      return exit_status;
-    }
+/* Returns the exit record of the current thread's child PID, or
+   NULL if PID is not a child or has already been waited for.  Only
+   the owning thread touches its children list, so no locking. */
+struct child *
+thread_find_child (pid_t pid)
+{
+  struct list *children = &thread_current ()->children;
+  struct list_elem *e;
+
+  for (e = list_begin (children); e != list_end (children); e = list_next (e)) {
+    struct child *c = list_entry (e, struct child, elem);
+    if (c->pid == pid) return c;
   }
+  return NULL;
+}
+
+/* Drops one reference to exit record C, freeing it once neither
+   the parent nor the child holds it.  The caller must already have
+   unlinked C from the parent's children list. */
+void
+thread_release_child (struct child *c)
+{
+  enum intr_level old_level = intr_disable ();
+  int refs = --c->refs;
   intr_set_level (old_level);
-  return -1;
+
+  if (refs == 0)
+    free (c);
 }
 
 int
@@ -835,18 +1212,30 @@ static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  struct thread *idle_thread = thread_current ();
+  this_rq ()->idle_thread = idle_thread;
   idle_thread->priority = PRI_MIN;
   idle_thread->actual_priority = PRI_MIN;
   sema_up (idle_started);
 
   for (;;) 
     {
+      /* Zero free pages ahead of PAL_ZERO allocations while there
+         is nothing else to do.  A thread that becomes ready
+         meanwhile preempts us on the next interrupt. */
+      while (palloc_zero_free_page ())
+        continue;
+
       /* Let someone else run. */
       intr_disable ();
       // printf("Idle at: %d\n", timer_ticks ());
       thread_block ();
 
+      /* Nothing is ready, so the tick can be stopped until some
+         sleeper is due.  The scheduler restarts it as soon as we
+         stop running. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -913,7 +1302,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
   t->wakeup_at = 0;
   t->sleeping = false;
-  t->child_threads = 0;
+  list_init (&t->children);
 
   if (!thread_mlfqs) {
     t->priority = priority;
@@ -923,6 +1312,7 @@ init_thread (struct thread *t, const char *name, int priority)
   } else {
     t->nice = 0;
     t->recent_cpu = 0;
+    t->decay_epoch = decay_epoch;
     // when nice and recent_cpu are 0, priority is PRI_MAX
     t->priority = PRI_MAX;
     t->actual_priority = PRI_MAX;
@@ -946,138 +1336,290 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* This method is same as the find_next_thread, but starts to check for available
- * threads in the multilevel list with highest priority. Finds the next available 
- * thread of highest priority by default (round robin with highest priority)
- * NOTE: in thread_update_all_priorities (), threads should be updated in same order
-*/
-static struct thread *
-find_next_thread_mlfqs (struct thread *cur UNUSED)
+/* Returns the running CPU's run queue. */
+static struct runqueue *
+this_rq (void)
 {
-  enum intr_level old_level = intr_disable ();
-  bool found = false;
+  return &boot_rq;
+}
 
-  struct thread *next;
-  struct list_elem *it;
-  struct list_elem *t_max;
-  struct list *tlist;
-
-  for (int i = PRI_MAX; i >= 0; i--) {
-    tlist = &multilevel_lists[i];
-    if (list_size (tlist) > 0) {
-      for (it = list_begin (tlist); it != list_end (tlist); it = list_next (it)) {
-        next = list_entry (it, struct thread, elem);
-        // ensure no mismatches
-        ASSERT (next->priority == i);
-        if (next->sleeping || next->status != THREAD_READY) {
-          continue;
-        }
-        t_max = it;
-        found = true;
-        break;
-      }
-      if (found) {
-        next = list_entry (t_max, struct thread, elem);
-        ASSERT (is_thread (next));
-        list_remove (&next->elem);
-        intr_set_level (old_level);
-        return next;
-      }
-    }
+/* Appends T to the bucket of its current priority in RQ. */
+static void
+ready_push_back (struct runqueue *rq, struct thread *t)
+{
+  ASSERT (spinlock_is_locked (&rq->lock));
+  if (thread_is_dl (t)) {
+    if (t->dl_throttled)
+      list_push_back (&rq->dl_throttled, &t->elem);
+    else
+      rbtree_insert (&rq->dl_tree, &t->rbelem);
+    return;
   }
-  ASSERT (is_thread (idle_thread));
-  intr_set_level (old_level);
-  return idle_thread;
+  if (thread_cfs) {
+    rbtree_insert (&rq->cfs_tree, &t->rbelem);
+    rq->cfs_weight += cfs_weight (t);
+    return;
+  }
+  list_push_back (&rq->ready_lists[t->priority], &t->elem);
+  rq->ready_mask |= (uint64_t) 1 << t->priority;
 }
 
-/* Iterates through the ready list to find a suitable thread */
-static struct thread *
-find_next_thread (struct thread *cur)
+/* Prepends T to the bucket of its current priority in RQ.  cfs
+   and the deadline class have no buckets and go by T's key only. */
+static void
+ready_push_front (struct runqueue *rq, struct thread *t)
 {
-  enum intr_level old_level = intr_disable ();
-  int max_priority = -1;
-  if (!cur->sleeping) max_priority = cur->priority;
+  ASSERT (spinlock_is_locked (&rq->lock));
+  if (thread_cfs || thread_is_dl (t)) {
+    ready_push_back (rq, t);
+    return;
+  }
+  list_push_front (&rq->ready_lists[t->priority], &t->elem);
+  rq->ready_mask |= (uint64_t) 1 << t->priority;
+}
 
-  struct thread *next;
-  struct list_elem *it;
-  struct list_elem *t_pre;
-  struct list_elem *t_max;
-  bool found_cur = false;
-  bool found_pre = false;
-  bool found_max = false;
-
-  for (it = list_begin (&ready_list); it != list_end (&ready_list); it = list_next (it)) {
-    next = list_entry (it, struct thread, elem);
-    if (next == cur) {
-      found_cur = true;
-      continue;
-    }
-    if (next->sleeping || next->status != THREAD_READY) {
-      continue;
-    }
+/* Removes T, which must be in RQ, from its bucket. */
+static void
+ready_remove (struct runqueue *rq, struct thread *t)
+{
+  ASSERT (spinlock_is_locked (&rq->lock));
+  if (thread_is_dl (t)) {
+    if (t->dl_throttled)
+      list_remove (&t->elem);
+    else
+      rbtree_remove (&rq->dl_tree, &t->rbelem);
+    return;
+  }
+  if (thread_cfs) {
+    rbtree_remove (&rq->cfs_tree, &t->rbelem);
+    rq->cfs_weight -= cfs_weight (t);
+    return;
+  }
+  list_remove (&t->elem);
+  if (list_empty (&rq->ready_lists[t->priority]))
+    rq->ready_mask &= ~((uint64_t) 1 << t->priority);
+}
 
-    // Find any eligible threads before the current thread with same priority
-    // for round robin, if no higher priority thread is found later
-    if (!found_cur && !found_pre && next->priority == cur->priority) {
-      t_pre = it;
-      found_pre = true;
-    }
+/* Moves T, which must be in RQ, to the front or the back of the
+   bucket of its new PRIORITY. */
+static void
+ready_requeue (struct runqueue *rq, struct thread *t, int priority, bool front)
+{
+  ready_remove (rq, t);
+  t->priority = priority;
+  if (front)
+    ready_push_front (rq, t);
+  else
+    ready_push_back (rq, t);
+}
 
-    // This takes the highest priority -> an eligible thread at any place in the
-    // ready queue with a priority larger than cur
-    if (next->priority > max_priority) {
-      t_max = it;
-      max_priority = next->priority;
-      found_max = true;
-    }
+/* Returns the highest priority with a ready thread in RQ, or -1 if
+   it is empty.  Uses a bit scan on each half of the mask rather
+   than a 64-bit builtin, which would need libgcc. */
+static int
+ready_max_priority (struct runqueue *rq)
+{
+  uint32_t high = rq->ready_mask >> 32;
+  uint32_t low = rq->ready_mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  if (low != 0)
+    return 31 - __builtin_clz (low);
+  return -1;
+}
+
+/* Returns the cfs weight of T's nice value. */
+static unsigned long
+cfs_weight (const struct thread *t)
+{
+  return cfs_weights[t->nice + 20];
+}
+
+/* Orders threads by vruntime for the cfs tree. */
+static bool
+cfs_less (const struct rbtree_elem *a, const struct rbtree_elem *b,
+          void *aux UNUSED)
+{
+  return (rbtree_entry (a, struct thread, rbelem)->vruntime
+          < rbtree_entry (b, struct thread, rbelem)->vruntime);
+}
+
+/* Charges the running thread of RQ for the time it ran since it was
+ * last charged, and moves min_vruntime up to the least vruntime.
+ * The running thread must not be in the tree, since its key changes */
+static void
+cfs_update_curr (struct runqueue *rq)
+{
+  struct thread *cur = running_thread ();
+  int64_t now = timer_nanoseconds ();
+  int64_t vruntime;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  cur->vruntime += (now - cur->exec_start) * CFS_NICE_0_WEIGHT / (int64_t) cfs_weight (cur);
+  cur->exec_start = now;
+
+  vruntime = cur->vruntime;
+  if (!rbtree_empty (&rq->cfs_tree)) {
+    struct thread *first = rbtree_entry (rbtree_min (&rq->cfs_tree), struct thread, rbelem);
+    if (first->vruntime < vruntime) vruntime = first->vruntime;
   }
+  if (vruntime > rq->min_vruntime) rq->min_vruntime = vruntime;
+}
 
-  /* Iterates from left to right of the ready thread, comparing priority
-   * and thread status. Corner cases -
-   *   1. Current thread was blocked/dying
-   *   2. All threads are sleeping
-  */ 
-  if (max_priority == -1) {
-    // cur is sleeping and no thread was found in the search -> schedule idle_thread
-    next = idle_thread;
-  } else if (max_priority > cur->priority) {
-    // a thread with priority > cur was found
-    next = list_entry (t_max, struct thread, elem);
-    list_remove (t_max);
-  } else if (found_pre) {
-    // a thread with priority = cur was found before cur, perform round-robin
-    next = list_entry (t_pre, struct thread, elem);
-    list_remove (t_pre);
-  } else if (!cur->sleeping && found_cur) {
-    next = cur;
-    list_remove (&cur->elem);
-  } else if (found_max) {
-    next = list_entry (t_max, struct thread, elem);
-    list_remove (t_max);
-  } else {
-    // cur was blocked or dying
-    ASSERT (found_cur == false);
-    ASSERT (cur->status == THREAD_BLOCKED || cur->status == THREAD_DYING);
-    next = idle_thread;
+/* Returns how long T, running on RQ, may keep the CPU: its weight's
+ * share of the period in which every ready thread runs once */
+static int64_t
+cfs_slice (struct runqueue *rq, const struct thread *t)
+{
+  int64_t nr_running = rbtree_size (&rq->cfs_tree) + 1;
+  int64_t period = CFS_LATENCY;
+
+  if (nr_running * CFS_MIN_SLICE > period) period = nr_running * CFS_MIN_SLICE;
+  return period * cfs_weight (t) / (rq->cfs_weight + cfs_weight (t));
+}
+
+/* Returns true if T is in the deadline class. */
+static bool
+thread_is_dl (const struct thread *t)
+{
+  return t->dl_period != 0;
+}
+
+/* Orders threads by absolute deadline for the deadline tree. */
+static bool
+dl_less (const struct rbtree_elem *a, const struct rbtree_elem *b,
+         void *aux UNUSED)
+{
+  return (rbtree_entry (a, struct thread, rbelem)->dl_abs_deadline
+          < rbtree_entry (b, struct thread, rbelem)->dl_abs_deadline);
+}
+
+/* Charges the running deadline thread's budget for the time it ran
+ * since it was last charged */
+static void
+dl_update_curr (void)
+{
+  struct thread *cur = running_thread ();
+  int64_t now = timer_nanoseconds ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  cur->dl_budget -= now - cur->dl_exec_start;
+  cur->dl_exec_start = now;
+}
+
+/* Gives each throttled thread of RQ whose next period has started
+ * its budget back, overrun deducted, and requests a yield on return
+ * if one of them should preempt the running thread.  Called by the
+ * timer interrupt at each tick */
+static void
+dl_replenish (struct runqueue *rq)
+{
+  struct list_elem *e;
+  bool preempt = false;
+
+  ASSERT (intr_context ());
+  if (list_empty (&rq->dl_throttled)) return;
+
+  int64_t now = timer_nanoseconds ();
+  spinlock_acquire (&rq->lock);
+  for (e = list_begin (&rq->dl_throttled); e != list_end (&rq->dl_throttled);) {
+    struct thread *t = list_entry (e, struct thread, elem);
+    int64_t release = t->dl_abs_deadline - t->dl_deadline + t->dl_period;
+    e = list_next (e);
+    if (release > now) continue;
+
+    t->dl_abs_deadline = release + t->dl_deadline;
+    t->dl_budget += t->dl_runtime;
+    if (t->dl_budget <= 0) continue;
+    list_remove (&t->elem);
+    t->dl_throttled = false;
+    rbtree_insert (&rq->dl_tree, &t->rbelem);
+    if (thread_preempts (t)) preempt = true;
   }
-  intr_set_level (old_level);
-  return next;
+  spinlock_release (&rq->lock);
+  if (preempt) intr_yield_on_return ();
 }
 
+/* Changes T's effective priority to PRIORITY.  If T is in the run
+ * queue, it is moved to the front of the new bucket so that a thread
+ * receiving a donation is picked before the donor, which yields next */
+static void
+requeue_with_priority (struct thread *t, int priority)
+{
+  struct runqueue *rq = this_rq ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+  if (t->status == THREAD_READY && t != rq->idle_thread && t->priority != priority) {
+    spinlock_acquire (&rq->lock);
+    ready_requeue (rq, t, priority, true);
+    spinlock_release (&rq->lock);
+  } else {
+    t->priority = priority;
+  }
+}
 
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
+   return a thread from run queue RQ, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   its idle thread. */
+/* Both the priority and the mlfqs scheduler pick the head of the
+   highest non-empty bucket, which gives round robin within a priority
+   since yielding threads are appended to their bucket. */
 static struct thread *
-next_thread_to_run (struct thread *cur) 
+next_thread_to_run (struct runqueue *rq) 
 {
-  if (thread_mlfqs) {
-    return find_next_thread_mlfqs (cur);
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (spinlock_is_locked (&rq->lock));
+  int priority = ready_max_priority (rq);
+  struct thread *next;
+
+  /* deadline threads come before every other class, earliest first */
+  if (!rbtree_empty (&rq->dl_tree)) {
+    next = rbtree_entry (rbtree_min (&rq->dl_tree), struct thread, rbelem);
+    ASSERT (is_thread (next));
+    ready_remove (rq, next);
+    return next;
   }
 
-  return find_next_thread (cur);
+  /* cfs runs the thread that is furthest behind */
+  if (thread_cfs) {
+    if (rbtree_empty (&rq->cfs_tree)) return rq->idle_thread;
+    next = rbtree_entry (rbtree_min (&rq->cfs_tree), struct thread, rbelem);
+    ASSERT (is_thread (next));
+    ready_remove (rq, next);
+    return next;
+  }
+
+  /* With mlfqs, the head of the top bucket may have missed a decay
+   * and belong elsewhere - refresh a bounded number of candidates */
+  for (int i = 0; thread_mlfqs && priority >= 0 && i < REFRESH_BATCH; i++) {
+    next = list_entry (list_front (&rq->ready_lists[priority]), struct thread, elem);
+    if (next->decay_epoch == decay_epoch) break;
+    mlfqs_decay (next);
+    int new_priority = calculate_priority (next->recent_cpu, next->nice);
+    if (new_priority != next->priority) ready_requeue (rq, next, new_priority, false);
+    priority = ready_max_priority (rq);
+  }
+
+  if (priority < 0) {
+    ASSERT (is_thread (rq->idle_thread));
+    return rq->idle_thread;
+  }
+
+  next = list_entry (list_front (&rq->ready_lists[priority]), struct thread, elem);
+  ASSERT (is_thread (next));
+  ASSERT (next->priority == priority);
+  ready_remove (rq, next);
+
+  /* recent_cpu of the running thread must be current before it ticks */
+  if (thread_mlfqs && next != rq->idle_thread) {
+    mlfqs_decay (next);
+    next->priority = calculate_priority (next->recent_cpu, next->nice);
+  }
+  return next;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -1100,6 +1642,7 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  struct runqueue *rq = this_rq ();
   
   ASSERT (intr_get_level () == INTR_OFF);
 
@@ -1107,7 +1650,16 @@ thread_schedule_tail (struct thread *prev)
   cur->status = THREAD_RUNNING;
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  rq->thread_ticks = 0;
+  if (thread_is_dl (cur)) {
+    cur->dl_exec_start = timer_nanoseconds ();
+  } else if (thread_cfs) {
+    cur->exec_start = timer_nanoseconds ();
+    rq->slice_start = cur->exec_start;
+  }
+
+  /* The switch is done, so the run queue can be let go of. */
+  spinlock_release (&rq->lock);
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -1126,10 +1678,11 @@ thread_schedule_tail (struct thread *prev)
     }
 }
 
-/* Schedules a new process.  At entry, interrupts must be off and
-   the running process's state must have been changed from
-   running to some other state.  This function finds another
-   thread to run and switches to it.
+/* Schedules a new process.  At entry, interrupts must be off,
+   the CPU's run queue lock must be held, and the running
+   process's state must have been changed from running to some
+   other state.  This function finds another thread to run and
+   switches to it.
 
    It's not safe to call printf() until thread_schedule_tail()
    has completed. */
@@ -1137,14 +1690,18 @@ thread_schedule_tail (struct thread *prev)
 static void
 schedule (void) 
 {
-  // sleeping threads shouldn't be woken up at any other place
-  wakeup_threads ();
   struct thread *cur = running_thread ();
+  struct runqueue *rq = this_rq ();
   struct thread *next;
-  if (ready_threads == 0 && is_thread (idle_thread)) {
-    next = idle_thread;
+
+  ASSERT (spinlock_is_locked (&rq->lock));
+  if (cur == rq->idle_thread) timer_idle_exit ();
+  else if (thread_is_dl (cur)) dl_update_curr ();
+  else if (thread_cfs && cur->status != THREAD_READY) cfs_update_curr (rq);
+  if (ready_threads == 0 && is_thread (rq->idle_thread)) {
+    next = rq->idle_thread;
   } else {
-    next = next_thread_to_run (cur);
+    next = next_thread_to_run (rq);
   }
   struct thread *prev = NULL;
   // int cur_tid = cur->tid;
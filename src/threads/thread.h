@@ -2,7 +2,9 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <rbtree.h>
 #include <stdint.h>
 #include "threads/fixed-point.h"
 #include "threads/synch.h"
@@ -24,16 +26,24 @@ typedef int mapid_t;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
 #define TNAME_MAX 32
-#define MAX_CHILDREN 10
 #define MAX_PRIORITY_DONATION 8
 #define MAX_OPEN_FD 10
 #define MAX_VADDR_MAPS 10
 #define INITIAL_FD 2                   /* 0 and 1 are reserved values for stdin/stdout */
 
-/* TODO: this is not handled cleanly, eg, for exec, child doesn't set this before doing a sema_up */
-struct children {
+/* Exit record of a child process.  The parent allocates it in
+   process_execute () and keeps it on its `children' list; the
+   child fills it in and ups the semaphores.  Whichever of the two
+   lets go of it last frees it (see thread_release_child). */
+struct child {
   pid_t pid;
   int exit_status;
+  bool loaded;                  /* Result of load (), valid after load_sema. */
+  struct semaphore load_sema;   /* Upped by the child once load () is done. */
+  struct semaphore exit_sema;   /* Upped by the child in thread_exit (). */
+  int refs;                     /* 2 while both parent and child hold it. */
+  char *cmdline;                /* Page handed to start_process (). */
+  struct list_elem elem;        /* Element in the parent's children list. */
 };
 
 enum vaddr_map_type {
@@ -46,6 +56,7 @@ struct vaddr_map {
   uint32_t *svaddr;
   uint32_t *evaddr;
   int fd;                          /* set to -1 for non-file mappings */
+  struct file *file;               /* own handle on fd's file, so pages can be read back after close () */
   int filesize;
   unsigned file_start;
 };
@@ -115,6 +126,7 @@ struct thread
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct list_elem tidelem;           /* List element for tid index. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -142,6 +154,21 @@ struct thread
     /* for mlfqs */
     int nice;
     fxpoint recent_cpu;
+    int64_t decay_epoch;                /* # of recent_cpu decays applied. */
+
+    /* for cfs */
+    int64_t vruntime;                   /* Run time in ns, scaled by weight. */
+    int64_t exec_start;                 /* When last charged for its run time. */
+    struct rbtree_elem rbelem;          /* Element in a run queue tree. */
+
+    /* for the deadline class, in ns - dl_period is 0 outside it */
+    int64_t dl_runtime;                 /* Budget in each period. */
+    int64_t dl_period;                  /* Period. */
+    int64_t dl_deadline;                /* Deadline, relative to release. */
+    int64_t dl_abs_deadline;            /* Deadline of the current job. */
+    int64_t dl_budget;                  /* Runtime left for the current job. */
+    int64_t dl_exec_start;              /* When last charged for its run time. */
+    bool dl_throttled;                  /* Out of budget until the next period. */
 
     /* user programs */
     bool user_thread;
@@ -149,20 +176,20 @@ struct thread
     pid_t parent_pid;
     int exit_status;
 
-    /* for quick retrieval */
-    int child_threads;
-    struct children t_children[MAX_CHILDREN];
+    /* exit records of children, and this thread's record in its parent's list */
+    struct list children;
+    struct child *child_record;
 
     /* stores struct file which is opened during load, closed in thread_exit () */
     struct file *exfile;
 
+    /* pages of exfile that are read in on first access, see struct load_page */
+    struct hash load_pages;
+
     /* fds are per process */
     struct file* file_descriptors[MAX_OPEN_FD];
     int open_fds;
 
-    /* parent does a sema_down and waits for exec'd child to complete load and do a sema_up */
-    struct semaphore child_sema;
-
     /* all mappings */
     uint32_t *code_segment;
     uint32_t *end_code_segment;
@@ -177,6 +204,12 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the completely fair scheduler instead: always run
+   the ready thread that has had the least run time, weighted by
+   its nice value.
+   Controlled by kernel command-line option "-cfs". */
+extern bool thread_cfs;
+
 void thread_init (void);
 void thread_start (void);
 
@@ -196,6 +229,9 @@ void print_all_priorities (void);
 /* sleep without busy waiting */
 void thread_make_sleep (int64_t);
 void thread_wakeup (struct thread *);
+void thread_wakeup_sleepers (int64_t);
+bool thread_preempts (const struct thread *);
+int64_t thread_next_wakeup (int64_t limit);
 
 void clean_orphan_threads (void);
 
@@ -220,6 +256,7 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+bool thread_set_deadline (int64_t runtime, int64_t period, int64_t deadline);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -227,16 +264,17 @@ int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
 void thread_set_load_avg (void);
-void thread_set_recent_cpu (struct thread *t);
-void thread_update_all_priorities (void);
+void thread_update_priority (void);
 void thread_recent_cpu_tick (void);
-void thread_update_all_recent_cpu (void);
+void thread_decay_recent_cpu (void);
+void thread_mlfqs_refresh (struct thread *);
+void thread_refresh_priorities (void);
 
 int all_ready_threads (void);
 
 /* for syscalls */
-int fetch_child_exit_status (pid_t);
-void update_exit_status_for_parent (void);
+struct child * thread_find_child (pid_t);
+void thread_release_child (struct child *);
 
 /* for file syscalls */
 bool is_valid_fd (int);
@@ -151,17 +151,30 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* a write to a page shared copy-on-write by fork (), from the process or the kernel on its behalf (CR0.WP is
+   *   set), gets the process its own copy */
+  if (!not_present && write && is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL
+      && pagedir_break_cow (thread_current ()->pagedir, fault_addr))
+    return;
+
   /* to test the section, set the esp to PHYS_BASE - 10000 for a pte with value zero
    * for a pte in swap, other tests */
-  if (user && not_present) {
+  /* evicted pages are brought back for the kernel too, eg, for a read () into a user buffer */
+  if (not_present && is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL) {
     struct thread *cur = thread_current ();
     uint32_t *pte = pagedir_get_pte (cur->pagedir, fault_addr);
     if (pte_in_swap (pte)) {
       /* TODO: this is causing breakpoint exception */
-      if (bring_from_swap (thread_current ()->pid, fault_addr)) {
+      if (bring_from_swap (fault_addr)) {
         return;
       }
-    } else if (is_stack_vaddr (fault_addr)) {
+    } else if (load_lazy_page (fault_addr) || load_mapped_page (fault_addr)) {
+      return;
+    }
+  }
+
+  if (user && not_present) {
+    if (is_stack_vaddr (fault_addr)) {
       if (abs (f->esp - fault_addr) > 32) {
         /* TODO: are there other corner cases? */
         exit (-1);
@@ -6,6 +6,8 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
+#include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
 
 static uint32_t *active_pd (void);
@@ -25,7 +27,8 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  The caller must hold the frame lock, so that
+   the page-out daemon stays off frames that are being freed. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -43,13 +46,11 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++) {
           if (*pte & PTE_P) {
-            clear_frame (pte_get_page (*pte));
-            palloc_free_page (pte_get_page (*pte));
+            /* a shared text page stays for its other processes */
+            if (clear_frame (pte_get_page (*pte), pte))
+              palloc_free_page (pte_get_page (*pte));
           } else if (pte_in_swap (pte)) {
-            /* TODO: store the swap slot in pte 20 bits at the time of swapping */
-            int slot = find_in_swap (thread_current ()->pid, pte);
-            ASSERT (slot != -1);
-            free_swapslot (slot);
+            free_swapslot (pte_get_swap_slot (*pte));
           }
         }
         palloc_free_page (pt);
@@ -169,9 +170,11 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
+   If SWAP_SLOT is not -1, the page is marked as swapped out to
+   that slot.
    UPAGE need not be mapped. */
 void
-pagedir_clear_page (uint32_t *pd, void *upage, bool mark_swapped) 
+pagedir_clear_page (uint32_t *pd, void *upage, int swap_slot) 
 {
   // printf("Clearing page with address: %p, for tid: %d\n", upage, thread_current ()->tid);
   uint32_t *pte;
@@ -181,13 +184,191 @@ pagedir_clear_page (uint32_t *pd, void *upage, bool mark_swapped)
 
   pte = lookup_page (pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0) {
-    clear_frame (pte_get_page (*pte));
+    clear_frame (pte_get_page (*pte), pte);
     *pte &= ~PTE_P;
-    if (mark_swapped) *pte |= PTE_S;
+    if (swap_slot != -1) {
+      /* a copy-on-write page is only evicted once no one else
+         shares it, so it comes back as a plain writable page */
+      if (*pte & PTE_COW) *pte = (*pte | PTE_W) & ~PTE_COW;
+      *pte = pte_create_swapped (*pte, swap_slot);
+    }
     invalidate_pagedir (pd);
   }
 }
 
+/* Removes user virtual page UPAGE from PD, and frees its frame,
+   unless another process still shares it, or its swap slot.
+   UPAGE need not be mapped.  The caller must hold the frame
+   lock. */
+void
+pagedir_free_page (uint32_t *pd, void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL)
+    return;
+  if (*pte & PTE_P)
+    {
+      if (clear_frame (pte_get_page (*pte), pte))
+        palloc_free_page (pte_get_page (*pte));
+    }
+  else if (pte_in_swap (pte))
+    free_swapslot (pte_get_swap_slot (*pte));
+  *pte = 0;
+  invalidate_pagedir (pd);
+}
+
+/* Maps UPAGE in CHILD_PD the way PTE maps it in the parent's
+   page directory, for pagedir_fork ().  A present page is
+   shared, copy-on-write if it is writable, unless its frame can
+   take no more sharers; such a page, or one out in swap, is
+   copied into *SPARE, which is then used up.  Returns false if
+   memory ran out. */
+static bool
+fork_page (uint32_t *child_pd, void *upage, uint32_t *pte, void **spare)
+{
+  uint32_t *child_pte = lookup_page (child_pd, upage, true);
+  bool writable = (*pte & (PTE_W | PTE_COW)) != 0;
+
+  if (child_pte == NULL)
+    return false;
+
+  if (*pte & PTE_P)
+    {
+      void *kpage = pte_get_page (*pte);
+      if (!frame_is_shared (kpage, true))
+        {
+          *child_pte = pte_create_user (kpage, false) | (*pte & PTE_D);
+          if (writable)
+            {
+              *child_pte |= PTE_COW;
+              *pte = (*pte & ~PTE_W) | PTE_COW;
+            }
+          map_frame (kpage, child_pte, upage);
+          return true;
+        }
+      memcpy (*spare, kpage, PGSIZE);
+    }
+  else
+    read_from_swapslots (pte_get_swap_slot (*pte), 1, spare);
+
+  *child_pte = pte_create_user (*spare, writable) | (*pte & PTE_D);
+  map_frame (*spare, child_pte, upage);
+  *spare = NULL;
+  return true;
+}
+
+/* Copies the user mappings of page directory PD into CHILD_PD,
+   the page directory of the running thread, for fork ().
+   Writable pages are shared copy-on-write: both processes map
+   them read-only until one writes, see pagedir_break_cow ().
+   Pages that were never loaded need nothing, as the child gets
+   its own table of the executable's pages.
+   PD must not be active; its stale TLB entries go when it is
+   activated again.  Returns false if memory ran out, leaving
+   CHILD_PD to be destroyed by the caller. */
+bool
+pagedir_fork (uint32_t *child_pd, uint32_t *pd)
+{
+  uint32_t *pde;
+  void *spare = NULL;
+  bool success = true;
+
+  ASSERT (active_pd () != pd);
+
+  lock_frames ();
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE) && success; pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte && success; pte++)
+          {
+            void *upage = (void *) (((pde - pd) << PDSHIFT)
+                                    | ((pte - pt) << PTSHIFT));
+
+            if ((*pte & (PTE_P | PTE_S)) == 0)
+              continue;
+
+            /* Keep a page at hand in case this one must be
+               copied.  Getting it may evict, which takes the
+               frame lock, and may take this very page. */
+            if (spare == NULL)
+              {
+                unlock_frames ();
+                spare = get_user_page (false);
+                lock_frames ();
+                if (spare == NULL)
+                  success = false;
+                else if ((*pte & (PTE_P | PTE_S)) == 0)
+                  continue;
+              }
+            if (success)
+              success = fork_page (child_pd, upage, pte, &spare);
+          }
+      }
+  unlock_frames ();
+
+  if (spare != NULL)
+    free_user_page (spare);
+  return success;
+}
+
+/* Gives the running process its own copy of the copy-on-write
+   page at VADDR in PD, after a write to it faulted.  A page that
+   no other process shares any longer is just made writable
+   again.  Returns false if VADDR is not a copy-on-write page or
+   if memory ran out. */
+bool
+pagedir_break_cow (uint32_t *pd, const void *vaddr)
+{
+  void *upage = pg_round_down (vaddr);
+  uint32_t *pte = lookup_page (pd, upage, false);
+  void *kpage = NULL;
+
+  if (!pte_is_cow (pte))
+    return false;
+
+  lock_frames ();
+  if (pte_is_cow (pte) && frame_is_shared (pte_get_page (*pte), false))
+    {
+      /* Getting a page may evict, which takes the frame lock.
+         Meanwhile the page may be evicted, or the other
+         sharers may go away. */
+      unlock_frames ();
+      kpage = get_user_page (false);
+      if (kpage == NULL)
+        return false;
+      lock_frames ();
+    }
+
+  if (pte_is_cow (pte))
+    {
+      void *old = pte_get_page (*pte);
+      if (frame_is_shared (old, false))
+        {
+          memcpy (kpage, old, PGSIZE);
+          clear_frame (old, pte);
+          *pte &= ~PTE_P;
+          pagedir_set_page (pd, upage, kpage, true);
+          kpage = NULL;
+        }
+      else
+        *pte = (*pte | PTE_W) & ~PTE_COW;
+      invalidate_pagedir (pd);
+    }
+  unlock_frames ();
+
+  if (kpage != NULL)
+    free_user_page (kpage);
+  return true;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
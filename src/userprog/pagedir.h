@@ -6,10 +6,13 @@
 
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
+bool pagedir_fork (uint32_t *child_pd, uint32_t *pd);
+bool pagedir_break_cow (uint32_t *pd, const void *upage);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 uint32_t *pagedir_get_pte (uint32_t *pd, const void *upage);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
-void pagedir_clear_page (uint32_t *pd, void *upage, bool);
+void pagedir_clear_page (uint32_t *pd, void *upage, int swap_slot);
+void pagedir_free_page (uint32_t *pd, void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
@@ -14,13 +14,26 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool copy_process (struct thread *parent);
+
+/* What a forked child takes from its parent, which stays blocked
+   in fork () until the child is done with it. */
+struct fork_info
+  {
+    struct child *record;       /* The child's exit record. */
+    struct thread *parent;      /* The process being copied. */
+    struct intr_frame if_;      /* Its user context at fork (). */
+  };
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -29,6 +42,7 @@ static bool load (const char *cmdline, void (**eip) (void), void **esp);
 tid_t
 process_execute (const char *file_name) 
 {
+  struct child *c;
   char *fn_copy;
   tid_t tid;
 
@@ -39,21 +53,33 @@ process_execute (const char *file_name)
     return TID_ERROR;
   strlcpy (fn_copy, file_name, PGSIZE);
 
+  /* The exit record is handed to the child through start_process's
+     argument, since the child may run, and exit, before
+     thread_create () returns here. */
+  c = malloc (sizeof *c);
+  if (c == NULL) {
+    palloc_free_page (fn_copy);
+    return TID_ERROR;
+  }
+  c->exit_status = -2;
+  c->loaded = false;
+  sema_init (&c->load_sema, 0);
+  sema_init (&c->exit_sema, 0);
+  c->refs = 2;
+  c->cmdline = fn_copy;
+
   struct thread *cur = thread_current ();
   /* Create a new thread to execute FILE_NAME. */
 
   /* Priority maybe larger than cur->priority, should be handled by proper cleanup */
-  tid = thread_create (file_name, cur->priority, start_process, fn_copy);
+  tid = thread_create (file_name, cur->priority, start_process, c);
 
   if (tid == TID_ERROR) {
     palloc_free_page (fn_copy);
+    free (c);
   } else {
-    /* child may've already completed and exited by this time if priority was larger
-     * still, the parent should store the childs pid/tid in case it'll call wait () later
-     * the user process exit mechanism should handle that */
-    cur->t_children[cur->child_threads].pid = tid;
-    cur->t_children[cur->child_threads].exit_status = -2;
-    cur->child_threads++;
+    c->pid = tid;
+    list_push_back (&cur->children, &c->elem);
   }
   return tid;
 }
@@ -61,12 +87,15 @@ process_execute (const char *file_name)
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *child_)
 {
-  char *file_name = file_name_;
+  struct child *c = child_;
+  char *file_name = c->cmdline;
   struct intr_frame if_;
   bool success;
 
+  thread_current ()->child_record = c;
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -74,16 +103,15 @@ start_process (void *file_name_)
   if_.eflags = FLAG_IF | FLAG_MBS;
   success = load (file_name, &if_.eip, &if_.esp);
 
-  if (!success) {
+  if (!success)
     thread_current ()->exit_status = -1;
-    update_exit_status_for_parent ();
-  }
 
   /* If load failed, quit. */
+  c->cmdline = NULL;
   palloc_free_page (file_name);
 
-  struct thread *parent = get_thread_by_pid (thread_current ()->parent_pid);
-  if (parent != NULL) sema_up (&parent->child_sema);
+  c->loaded = success;
+  sema_up (&c->load_sema);
 
   if (!success)
     thread_exit ();
@@ -98,6 +126,120 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Starts a new thread running a copy of the current user
+   process, which resumes from the system call frame IF_ with
+   fork () returning 0.  Returns the new process's thread id, or
+   TID_ERROR if the thread cannot be created.  As with
+   process_execute (), the child ups its record's load_sema once
+   it knows whether the copy succeeded. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_info *info;
+  struct child *c;
+  tid_t tid;
+
+  info = malloc (sizeof *info);
+  c = malloc (sizeof *c);
+  if (info == NULL || c == NULL) {
+    free (info);
+    free (c);
+    return TID_ERROR;
+  }
+  c->exit_status = -2;
+  c->loaded = false;
+  sema_init (&c->load_sema, 0);
+  sema_init (&c->exit_sema, 0);
+  c->refs = 2;
+  c->cmdline = NULL;
+
+  info->record = c;
+  info->parent = cur;
+  info->if_ = *if_;
+
+  tid = thread_create (cur->name, cur->priority, fork_process, info);
+
+  if (tid == TID_ERROR) {
+    free (info);
+    free (c);
+  } else {
+    c->pid = tid;
+    list_push_back (&cur->children, &c->elem);
+  }
+  return tid;
+}
+
+/* A thread function that makes itself a copy of the process
+   that forked it, and returns to user mode where the parent
+   entered fork (). */
+static void
+fork_process (void *info_)
+{
+  struct fork_info *info = info_;
+  struct child *c = info->record;
+  struct intr_frame if_ = info->if_;
+  bool success;
+
+  thread_current ()->child_record = c;
+  success = copy_process (info->parent);
+  free (info);
+
+  if (!success)
+    thread_current ()->exit_status = -1;
+
+  c->loaded = success;
+  sema_up (&c->load_sema);
+
+  if (!success)
+    thread_exit ();
+
+  /* fork () returns 0 in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Makes the current thread a copy of user process PARENT: its
+   own handles on the executable, open files and file mappings,
+   and an address space sharing PARENT's pages copy-on-write. */
+static bool
+copy_process (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  t->user_thread = true;
+  t->exfile = file_reopen (parent->exfile);
+  if (t->exfile == NULL)
+    return false;
+  file_deny_write (t->exfile);
+
+  for (i = 0; i < MAX_OPEN_FD; i++)
+    if (parent->file_descriptors[i] != NULL)
+      {
+        t->file_descriptors[i] = file_reopen (parent->file_descriptors[i]);
+        if (t->file_descriptors[i] == NULL)
+          return false;
+        file_seek (t->file_descriptors[i],
+                   file_tell (parent->file_descriptors[i]));
+        t->open_fds++;
+      }
+
+  t->code_segment = parent->code_segment;
+  t->end_code_segment = parent->end_code_segment;
+  t->data_segment = parent->data_segment;
+  t->allocated_stack_pages = parent->allocated_stack_pages;
+  if (!copy_load_pages (parent, t->exfile) || !copy_vaddr_maps (parent))
+    return false;
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+  return pagedir_fork (t->pagedir, parent->pagedir);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -105,15 +247,19 @@ start_process (void *file_name_)
    been successfully called for the given TID, returns -1
    immediately, without waiting.
 
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   Blocks on the child's exit record, which thread_exit () ups, and
+   reaps the record so a second wait on TID fails. */
 int
 process_wait (tid_t child_tid) 
 {
-  for (; ;) {
-    if (get_thread_by_tid (child_tid) == NULL) break;
-  }
-  return -1;
+  struct child *c = thread_find_child (child_tid);
+  if (c == NULL) return -1;
+
+  sema_down (&c->exit_sema);
+  int exit_status = c->exit_status;
+  list_remove (&c->elem);
+  thread_release_child (c);
+  return exit_status;
 }
 
 /* Free the current process's resources. */
@@ -123,11 +269,16 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  free_vaddr_maps ();
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+      /* Hold the frame lock throughout, so that eviction never
+         sees this process without its page directory. */
+      lock_frames ();
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -138,7 +289,9 @@ process_exit (void)
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
+      unlock_frames ();
     }
+  free_load_pages ();
 }
 
 /* Sets up the CPU for running user code in the current
@@ -262,9 +415,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
      if (counter == MAX_ARGS) break;
   }
 
-  /* Allocate and activate page directory. */
+  /* Allocate and activate page directory, and the table of
+     pages to read in on demand. */
   t->pagedir = pagedir_create ();
-  if (t->pagedir == NULL) 
+  if (t->pagedir == NULL || !init_load_pages ()) 
     goto done;
   process_activate ();
 
@@ -430,8 +584,12 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   Nothing is read here: each page is recorded in the process's
+   load pages and read in by the page fault handler when it is
+   first touched.
+
    Return true if successful, false if a memory allocation error
-   or disk read error occurs. */
+   occurs. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -440,7 +598,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -449,31 +606,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Get a page of memory. */
-      uint8_t *kpage = get_user_page (false);
-      if (kpage == NULL) {
-        /* if page handler didn't get a page after a few tries, fail */
+      /* Record the page for demand loading. */
+      if (!add_load_page (upage, file, ofs, page_read_bytes, writable))
         return false;
-      }
-
-      /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
-        {
-          free_user_page (kpage);
-          return false; 
-        }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-
-      /* Add the page to the process's address space. */
-      if (!install_page (upage, kpage, writable)) 
-        {
-          free_user_page (kpage);
-          return false; 
-        }
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
 
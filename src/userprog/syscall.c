@@ -6,9 +6,22 @@
 #include "vm/page.h"
 #include "threads/pte.h"
 #include "filesys/filesys.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
 
 static void syscall_handler (struct intr_frame *);
 
+/* an evicted or not yet loaded page counts as mapped - touching it from the kernel brings it in in the page fault
+ *   handler */
+static bool
+is_mapped_addr (uint32_t *pd, const void *vaddr)
+{
+  if (pagedir_get_page (pd, vaddr) != NULL) return true;
+  if (pte_in_swap (pagedir_get_pte (pd, vaddr))) return true;
+  return is_file_backed_vaddr (thread_current (), (void *) vaddr)
+         || is_load_vaddr (thread_current (), (void *) vaddr);
+}
+
 static bool
 is_valid_addr (uint32_t *pd, const void *vaddr, size_t size)
 {
@@ -19,8 +32,8 @@ is_valid_addr (uint32_t *pd, const void *vaddr, size_t size)
   /* get the page for start/end addresses to verify
    * note that arguments are allowed to cross page boundaries and those checks will fail tests
    * ex. sc-boundary-2, sc-boundary-3, exec-bound-2, exec-bound-3 */
-  if (pagedir_get_page (pd, vaddr) == NULL) return false;
-  if (pagedir_get_page (pd, vaddr2) == NULL) return false;
+  if (!is_mapped_addr (pd, vaddr)) return false;
+  if (!is_mapped_addr (pd, vaddr2)) return false;
   return true;
 }
 
@@ -104,6 +117,11 @@ syscall_handler (struct intr_frame *f)
         f->eax = pid;
         return;
       }
+    case SYS_FORK:
+      {
+        f->eax = sys_fork (f);
+        return;
+      }
     case SYS_EXIT:
       {
         int status = get_argument (cur->pagedir, esp, 1, sizeof (int));
@@ -233,16 +251,10 @@ exit (int status)
   NOT_REACHED ();
 }
 
-/* checks for exit status of child to be a non-initial value before exiting */
 int
 wait (pid_t pid)
 {
-  int exit_status;
-  for (; ;) {
-    exit_status = fetch_child_exit_status (pid);
-    if (exit_status != -2) return exit_status;
-  }
-  NOT_REACHED ();
+  return process_wait (pid);
 }
 
 bool
@@ -266,17 +278,27 @@ halt (void)
 pid_t
 exec (const char *cmdline)
 {
-  struct thread *cur = thread_current ();
-  if (cur->child_threads == MAX_CHILDREN) return -1;
-
   tid_t tid = process_execute (cmdline);
-  if (tid != TID_ERROR) {
-    sema_down (&cur->child_sema);
-    struct thread *child = get_thread_by_pid (tid);
-    if (child != NULL && child->exit_status == -2) return child->pid;
-  }
+  if (tid == TID_ERROR) return -1;
+
+  /* wait for the child to finish load (); its exit record stays on
+   * our children list either way, so a later wait () still works */
+  struct child *c = thread_find_child (tid);
+  sema_down (&c->load_sema);
+  return c->loaded ? tid : -1;
+}
+
+/* the child resumes from F too, with its own copy of the address space, see process_fork () */
+pid_t
+sys_fork (struct intr_frame *f)
+{
+  tid_t tid = process_fork (f);
+  if (tid == TID_ERROR) return -1;
 
-  return -1;
+  /* wait for the child to copy this process, as exec () waits for load () */
+  struct child *c = thread_find_child (tid);
+  sema_down (&c->load_sema);
+  return c->loaded ? tid : -1;
 }
 
 int
@@ -303,6 +325,7 @@ mmap (int fd, void *addr)
   int fsize = filesize (fd);
   if (fsize == 0) return -1;
   mapid_t mapping = allocate_vaddr_mapid ();
+  if (mapping == -1) return -1;
 
   if (!write_file_to_vaddr (mapping, MAP_USER_FILES, addr, fsize, fd)) {
     free_vaddr_map (mapping);
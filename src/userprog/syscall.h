@@ -2,6 +2,7 @@
 #define USERPROG_SYSCALL_H
 
 #include <stdbool.h>
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 
 void syscall_init (void);
@@ -19,6 +20,7 @@ bool remove (const char *);
 
 /* Execution */
 pid_t exec (const char *);
+pid_t sys_fork (struct intr_frame *);
 int wait (pid_t);
 void exit (int);
 void halt (void);
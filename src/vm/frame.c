@@ -2,10 +2,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include "vm/frame.h"
 #include "userprog/pagedir.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 
 static size_t total_user_pages;
 static void *user_pool_base;
@@ -14,10 +20,34 @@ static void *user_pool_base;
  * NOTE: there's no management for frame count, etc - if palloc was able to give a page,
  *   then physical memory is available - and physical memory is a deterministic entity
  *   hence a direct mapping to slot number is possible and utilised */
-static uint32_t *framelist;
+static struct frame **framelist;
 
-/* this is a round robin eviction pointer */
-static int last_evicted_slot;
+/* clock hand: the slot to be looked at next for eviction */
+static size_t clock_hand;
+
+/* serializes evictions, and is held until the victim is written to swap */
+static struct lock evict_lock;
+
+/* WSClock working set window in timer ticks, 0 for plain clock - set by the -wsclock kernel option */
+unsigned frame_wsclock_tau;
+
+/* the page-out daemon is woken when free user pages drop below pageout_low, and evicts until there are
+ *   pageout_high of them - the marks are scaled down for small user pools */
+static size_t pageout_low;
+static size_t pageout_high;
+static struct semaphore pageout_sema;
+static bool pageout_pending;
+
+/* read-only text pages in memory, keyed by executable inode and offset, so that processes running the same
+ *   program map the same frames - protected by evict_lock */
+static struct hash text_pages;
+
+/* victims of one batch are copied here, and written to swap with one transfer */
+static uint8_t *pageout_buffer;
+
+static thread_func pageout_daemon NO_RETURN;
+static hash_hash_func text_page_hash;
+static hash_less_func text_page_less;
 
 void
 init_frame_table (void)
@@ -25,7 +55,15 @@ init_frame_table (void)
   user_pool_base = get_userpool_base ();
   total_user_pages = get_user_pages ();
   /* acquires kernel memory - non-pageable as of now */
-  framelist = malloc (total_user_pages * sizeof (uint32_t *));
+  framelist = calloc (total_user_pages, sizeof *framelist);
+  lock_init (&evict_lock);
+  hash_init (&text_pages, text_page_hash, text_page_less, NULL);
+
+  pageout_low = PAGEOUT_LOW_WATER < total_user_pages / 8 ? PAGEOUT_LOW_WATER : total_user_pages / 8;
+  pageout_high = 2 * pageout_low;
+  sema_init (&pageout_sema, 0);
+  pageout_buffer = palloc_get_multiple (PAL_ASSERT, PAGEOUT_BATCH);
+  thread_create ("pageout", PRI_MAX, pageout_daemon, NULL);
   return;
 }
 
@@ -37,74 +75,276 @@ paddr_to_slot (void *paddr)
   return (size_t) ((paddr - user_pool_base)/PGSIZE);
 }
 
+/* removes the mapping of the frame at ADDRESS through PTE - returns true if that was its last mapping, and the
+ *   page can be freed */
 bool
-clear_frame (void *address)
+clear_frame (void *address, uint32_t *pte)
 {
   size_t slot = paddr_to_slot (address);
-  struct frame *frm = *(framelist + slot);
-  *(framelist + slot) = 0;
+  struct frame *frm = framelist[slot];
+
+  if (frm != NULL && frm->shared > 0) {
+    int i = 0;
+    if (frm->pte == pte) {
+      /* the primary holder leaves - another sharer takes its place */
+      i = frm->shared - 1;
+      frm->pid = frm->shared_pids[i];
+      frm->pte = frm->shared_ptes[i];
+    } else {
+      while (i < frm->shared && frm->shared_ptes[i] != pte) i++;
+      ASSERT (i < frm->shared);
+    }
+    frm->shared--;
+    frm->shared_pids[i] = frm->shared_pids[frm->shared];
+    frm->shared_ptes[i] = frm->shared_ptes[frm->shared];
+    return false;
+  }
+
+  framelist[slot] = NULL;
+  if (frm != NULL && frm->prefetched) swap_prefetch_done (pte_is_accessed (frm->pte));
+  if (frm != NULL && frm->inode != NULL) hash_delete (&text_pages, &frm->elem);
   free (frm);
   return true;
 }
 
+/* maps the frame at ADDRESS to VADDR through PTE - a frame that is already mapped is a shared text page or a
+ *   page shared copy-on-write by fork (), and gets the current process as another sharer (the caller holds the
+ *   frame lock then) */
 void
 map_frame (void *address, void *pte, void *vaddr)
 {
+  size_t slot = paddr_to_slot (address);
+  struct frame *frm = framelist[slot];
+
+  if (frm != NULL) {
+    ASSERT (frm->shared < MAX_SHARERS && frm->vaddr == vaddr);
+    frm->shared_pids[frm->shared] = thread_current ()->pid;
+    frm->shared_ptes[frm->shared] = pte;
+    frm->shared++;
+    return;
+  }
+
   /* get a frame from kernel pool - address of this frame will be stored in frame table */
   struct frame *nframe = malloc (sizeof (struct frame));
   nframe->address = (uint32_t *) address;
   nframe->pte = (uint32_t *) pte;
   nframe->vaddr = (uint32_t *) vaddr;
   nframe->pid = thread_current ()->pid;
+  nframe->last_used = timer_ticks ();
+  nframe->prefetched = false;
+  nframe->inode = NULL;
+  nframe->shared = 0;
 
-  size_t slot = paddr_to_slot (address);
-  *(framelist + slot) = nframe;
+  framelist[slot] = nframe;
 }
 
-/* if all frames are non-dirty, then first frame is evicted and replaced all the time - that's not
- *   useful if recently accessed memory locations are likely to be accessed again */
+static unsigned
+text_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *frm = hash_entry (e, struct frame, elem);
+  return hash_bytes (&frm->inode, sizeof frm->inode) ^ hash_int (frm->ofs);
+}
 
-size_t
-evict_page (void)
+static bool
+text_page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, elem);
+  const struct frame *b = hash_entry (b_, struct frame, elem);
+  if (a->inode != b->inode) return a->inode < b->inode;
+  return a->ofs < b->ofs;
+}
+
+/* returns the frame holding the read-only text page at OFS of INODE, if some process has it in memory and it can
+ *   take another sharer, or else NULL - the caller must hold the frame lock, until it has mapped the frame */
+void *
+find_text_page (struct inode *inode, off_t ofs)
+{
+  struct frame key;
+  key.inode = inode;
+  key.ofs = ofs;
+
+  struct hash_elem *e = hash_find (&text_pages, &key.elem);
+  if (e == NULL) return NULL;
+  struct frame *frm = hash_entry (e, struct frame, elem);
+  return frm->shared < MAX_SHARERS ? frm->address : NULL;
+}
+
+/* enters the frame at ADDRESS, just mapped, into the shared text page cache as page OFS of INODE - the caller
+ *   must hold the frame lock */
+void
+add_text_page (void *address, struct inode *inode, off_t ofs)
+{
+  struct frame *frm = framelist[paddr_to_slot (address)];
+  frm->inode = inode;
+  frm->ofs = ofs;
+  if (hash_insert (&text_pages, &frm->elem) != NULL) frm->inode = NULL;
+}
+
+/* returns true if the frame at ADDRESS is mapped by more than one process, and can take no more sharers if FULL
+ *   - the caller must hold the frame lock */
+bool
+frame_is_shared (void *address, bool full)
+{
+  struct frame *frm = framelist[paddr_to_slot (address)];
+  if (frm == NULL) return false;
+  return full ? frm->shared == MAX_SHARERS : frm->shared > 0;
+}
+
+/* marks the frame at ADDRESS as read in by swap fault-around, to count whether it gets used */
+void
+set_frame_prefetched (void *address)
+{
+  struct frame *frm = framelist[paddr_to_slot (address)];
+  if (frm != NULL) frm->prefetched = true;
+}
+
+/* clears the accessed bit of PTE of process PID, mapping VADDR - returns true if it was set */
+static bool
+clear_accessed (uint32_t *pte, int pid, void *vaddr)
+{
+  if (!pte_is_accessed (pte)) return false;
+
+  *pte &= ~PTE_A;
+  /* the cpu only sets PTE_A again if the TLB entry is gone - other address spaces are flushed on switch */
+  if (pid == thread_current ()->pid)
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+  return true;
+}
+
+/* returns true if any process mapping FRM accessed it since the last call, and clears their accessed bits */
+static bool
+test_and_clear_accessed (struct frame *frm)
+{
+  bool accessed = clear_accessed (frm->pte, frm->pid, frm->vaddr);
+  for (int i = 0; i < frm->shared; i++)
+    accessed |= clear_accessed (frm->shared_ptes[i], frm->shared_pids[i], frm->vaddr);
+  return accessed;
+}
+
+/* clock (second chance) eviction: the hand sweeps the frame table, clearing the accessed bit of every frame it
+ *   passes - a frame is evicted once the hand comes back to it and finds the bit still clear
+ * with frame_wsclock_tau set (WSClock), a frame is only evicted if it also hasn't been used for that many ticks,
+ *   ie, it has aged out of its process' working set - if no frame has, the first frame with a clear bit is evicted
+ * returns the slot of the victim, or -1 if every frame is pinned or shared - the caller must hold evict_lock */
+static int
+select_victim (void)
 {
-  /* evicts the first non-dirty frame for simplicity - causes pagefault if swap is empty
-   * needs to acquire locks
-   * TODO: if a page is selected for eviction, then it might become dirty/accessed while being written to swap
-   *   for such a case, either disable interrupts while writing to swap, or invalidate immediately */
-  int slot = -1;
+  int64_t now = timer_ticks ();
+  int fallback = -1;
   struct frame *frm;
-  if (last_evicted_slot >= total_user_pages - 1) last_evicted_slot = 0;
-  int i = last_evicted_slot + 1;
-  int iters = 1;
-
-  while (iters != total_user_pages) {
-    frm = *(framelist + i);
-    if (!pte_is_dirty (frm->pte) && !pte_is_accessed (frm->pte)) {
-      slot = i;
-      last_evicted_slot = i;
-      int swapslot = get_swapslot ();
-      if (swapslot != -1) {
-        map_and_write_to_swapslot (swapslot, frm->pid, frm->vaddr);
-        *(framelist + i) = 0;
-        pagedir_clear_page (get_thread_by_pid (frm->pid)->pagedir, frm->vaddr, true);
-        free_user_page (frm->address);
-        // printf("evicted the page: %p, paddr: %p, from slot: %d, to swapslot: %d\n", frm->vaddr, frm->address, slot, swapslot);
-        free (frm);
-        break;
-      } else {
-        slot = -1;
-        /* swap is full */
-        // PANIC ();
+
+  /* two turns of the hand: the first one may only clear accessed bits */
+  for (size_t iters = 0; iters < 2 * total_user_pages; iters++) {
+    size_t i = clock_hand;
+    clock_hand = (clock_hand + 1) % total_user_pages;
+
+    frm = framelist[i];
+    if (frm == NULL || pte_is_pinned (frm->pte)) continue;
+    /* a copy-on-write page stays while it's shared, as each sharer would need its own swap slot */
+    if (frm->shared > 0 && frm->inode == NULL) continue;
+
+    if (test_and_clear_accessed (frm)) {
+      if (frm->prefetched) {
+        swap_prefetch_done (true);
+        frm->prefetched = false;
       }
+      frm->last_used = now;
+    } else if (frame_wsclock_tau == 0 || now - frm->last_used > frame_wsclock_tau) {
+      return i;
+    } else if (fallback == -1) {
+      fallback = i;
     }
-    if (i >= total_user_pages - 1) i = 0;
-    iters += 1;
   }
+  return fallback;
+}
+
+/* evicts up to CNT frames and returns how many were freed
+ * dirty and anonymous victims get adjacent swap slots and are written out together with one multi-sector
+ *   transfer, clean pages of an mmap'd file are dropped as they can be read back from the file */
+size_t
+evict_pages (size_t cnt)
+{
+  ASSERT (cnt <= PAGEOUT_BATCH);
+  lock_acquire (&evict_lock);
+
+  size_t slot_cnt = cnt;
+  int first_slot = get_swapslots (&slot_cnt);
+  size_t swapped = 0, freed = 0;
 
-  /* TODO: if all pages are accessed and dirty, let the page fault to continue? */
-  if (slot == -1) {
-    // PANIC ();
+  while (freed < cnt) {
+    int slot = select_victim ();
+    if (slot == -1) break;
+
+    struct frame *frm = framelist[slot];
+    struct thread *t = get_thread_by_pid (frm->pid);
+
+    /* unmap before copying, so that the page can't change while it's being written to swap - a fault on it
+     *   waits for this eviction to finish in lock_frames () */
+    enum intr_level old_level = intr_disable ();
+    bool to_swap = pte_is_dirty (frm->pte) || !is_file_backed_vaddr (t, frm->vaddr);
+    if (to_swap && swapped == slot_cnt) {
+      /* swap is full */
+      intr_set_level (old_level);
+      break;
+    }
+    if (frm->prefetched) swap_prefetch_done (false);
+    framelist[slot] = NULL;
+    pagedir_clear_page (t->pagedir, frm->vaddr, to_swap ? first_slot + (int) swapped : -1);
+    /* a shared text page is read-only, so it's dropped - from every process mapping it */
+    for (int i = 0; i < frm->shared; i++)
+      pagedir_clear_page (get_thread_by_pid (frm->shared_pids[i])->pagedir, frm->vaddr, -1);
+    intr_set_level (old_level);
+    if (frm->inode != NULL) hash_delete (&text_pages, &frm->elem);
+
+    if (to_swap) {
+      memcpy (pageout_buffer + swapped * PGSIZE, frm->address, PGSIZE);
+      swapped++;
+    }
+    free_user_page (frm->address);
+    free (frm);
+    freed++;
   }
 
-  return slot;
+  if (swapped > 0) write_to_swapslots (first_slot, swapped, pageout_buffer);
+  for (size_t i = swapped; i < slot_cnt; i++) free_swapslot (first_slot + i);
+
+  lock_release (&evict_lock);
+  return freed;
+}
+
+/* frames may not be evicted while they are being torn down, eg, by pagedir_destroy () */
+void
+lock_frames (void)
+{
+  lock_acquire (&evict_lock);
+}
+
+void
+unlock_frames (void)
+{
+  lock_release (&evict_lock);
+}
+
+/* wakes the page-out daemon if free user pages have run low */
+void
+check_free_frames (void)
+{
+  if (!pageout_pending && get_free_user_pages () < pageout_low) {
+    pageout_pending = true;
+    sema_up (&pageout_sema);
+  }
+}
+
+/* keeps free user pages between the low and high water marks, so that page faults can usually be served from
+ *   the free pool - victims are evicted a batch at a time, so their swap writes are batched too */
+static void
+pageout_daemon (void *aux UNUSED)
+{
+  for (;;) {
+    sema_down (&pageout_sema);
+    while (get_free_user_pages () < pageout_high) {
+      if (evict_pages (PAGEOUT_BATCH) == 0) break;
+    }
+    pageout_pending = false;
+  }
 }
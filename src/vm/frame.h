@@ -5,25 +5,49 @@
 #include "threads/pte.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/off_t.h"
 
 #define FRLINESIZE 4
 #define FRPERPAGE PGSIZE/FRLINESIZE
 
-// 56 bytes
+/* processes that can share a read-only text or copy-on-write frame, besides its primary holder */
+#define MAX_SHARERS 10
+
+/* free user pages the page-out daemon tries to keep, at most - and the frames it evicts at once */
+#define PAGEOUT_LOW_WATER 16
+#define PAGEOUT_BATCH 8
+
+extern unsigned frame_wsclock_tau;
+
+// 128 bytes
 struct frame {
   uint32_t *address;      // physical memory address
   uint32_t *pte;          // PTE for the frame for direct invalidation
   uint32_t *vaddr;        // vaddr
   int pid;                // primary holder process
+  int64_t last_used;      // tick the clock hand last found the frame accessed (WSClock)
+  bool prefetched;        // read in by swap fault-around, and not accessed since
+  struct inode *inode;    // for a read-only text page: its executable, and
+  off_t ofs;              //   offset there - the key in the shared text page cache
+  struct hash_elem elem;  // element in the shared text page cache
   int shared;             // number of processes shared with
-  int shared_pids[10];    // pid of upto 10 processes
+  int shared_pids[MAX_SHARERS];         // pid of upto 10 processes
+  uint32_t *shared_ptes[MAX_SHARERS];   // and their PTEs, all for vaddr - reverse mappings for eviction
 };
 
 size_t paddr_to_slot (void *);
 void map_frame (void *, void *, void *);
-bool clear_frame (void *);
-size_t evict_page (void);
+void set_frame_prefetched (void *);
+bool frame_is_shared (void *, bool);
+bool clear_frame (void *, uint32_t *);
+void *find_text_page (struct inode *, off_t);
+void add_text_page (void *, struct inode *, off_t);
+size_t evict_pages (size_t);
+void lock_frames (void);
+void unlock_frames (void);
+void check_free_frames (void);
 void init_frame_table (void);
 
 #endif /* vm/frame.h */
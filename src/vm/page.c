@@ -1,6 +1,10 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
@@ -12,17 +16,19 @@
  *   all virtual address accesses and updates go via this module
  */
 
+static struct vaddr_map *find_file_mapping (struct thread *, void *);
+
 void *
 get_user_page (bool zero)
 {
   enum palloc_flags flag = zero ? (PAL_USER | PAL_ZERO) : PAL_USER;
   uint8_t *kpage = palloc_get_page (flag);
   if (kpage == NULL) {
-    /* evict a page from the framelist, free it from userpool and retry palloc method
-     * alternatively, the evicted page is not freed from userpool and slot number can be used directly */
-    int slot = evict_page ();
+    /* the page-out daemon fell behind - evict a page inline, free it from userpool and retry palloc method */
+    evict_pages (1);
     kpage = palloc_get_page (flag);
   }
+  check_free_frames ();
   return kpage;
 }
 
@@ -104,86 +110,125 @@ free_vaddr_map (mapid_t mapid)
   struct vaddr_map *vmap = cur->vaddr_mappings[mapid];
   cur->vaddr_mappings[mapid] = NULL;
   cur->active_vaddr_maps--;
+  if (vmap != NULL) file_close (vmap->file);
   free (vmap);
 }
 
+/* unmaps the mappings left at process exit, writing their dirty pages back as munmap () does */
+void
+free_vaddr_maps (void)
+{
+  struct thread *cur = thread_current ();
+  for (int i = 0; i < MAX_VADDR_MAPS; i++) {
+    if (cur->vaddr_mappings[i] == NULL) continue;
+    write_back_to_file (i);
+    clear_vaddr_map_and_pte (i);
+  }
+}
+
+/* gives the running process, just forked, the file mappings of PARENT - the mapped pages themselves are shared
+ *   copy-on-write by pagedir_fork () */
+bool
+copy_vaddr_maps (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  for (int i = 0; i < MAX_VADDR_MAPS; i++) {
+    struct vaddr_map *vmap = parent->vaddr_mappings[i];
+    if (vmap == NULL) continue;
+
+    struct vaddr_map *copy = malloc (sizeof (struct vaddr_map));
+    if (copy == NULL) return false;
+    *copy = *vmap;
+    copy->file = vmap->file != NULL ? file_reopen (vmap->file) : NULL;
+    cur->vaddr_mappings[i] = copy;
+    cur->active_vaddr_maps++;
+  }
+  return true;
+}
+
 void
 set_vaddr_map (mapid_t mapid, enum vaddr_map_type mtype, uint32_t *vaddr, int filesize, int fd)
 {
   struct vaddr_map *vmap = malloc (sizeof (struct vaddr_map));
+  if (vmap == NULL) return;
   int pages = get_pages_for_size (filesize);
   vmap->mtype = mtype;
   vmap->svaddr = vaddr;
   vmap->evaddr = INCR_VADDR (vaddr, pages);
   vmap->fd = fd;
+  vmap->file = file_reopen (get_file (fd));
   vmap->filesize = filesize;
   thread_current ()->vaddr_mappings[mapid] = vmap;
 }
 
+/* true if page VADDR of the running process is taken - mapped or swapped out, a page of the executable or of
+ *   another file mapping, or reserved for the stack */
+static bool
+is_used_vaddr (void *vaddr)
+{
+  struct thread *cur = thread_current ();
+  if (!is_user_vaddr (vaddr) || is_stack_vaddr (vaddr)) return true;
+
+  uint32_t *pte = pagedir_get_pte (cur->pagedir, vaddr);
+  if (pte != NULL && (*pte & PTE_P) != 0) return true;
+  return pte_in_swap (pte) || is_load_vaddr (cur, vaddr) || find_file_mapping (cur, vaddr) != NULL;
+}
+
+/* records the mapping of file FD, FILESIZE bytes long, at ADDR - no page is read here, each one is read in from
+ *   the file on its first access by load_mapped_page () */
 bool
 write_file_to_vaddr (mapid_t mapping, enum vaddr_map_type mtype, uint32_t *addr, int filesize, int fd)
 {
-  /* handle freeing of pages if all pages can't be acquired, and then free the map */
-  uint32_t *page;
   struct thread *cur = thread_current ();
   int pages = get_pages_for_size (filesize);
 
   for (int i = 0; i < pages; i++) {
-    page = get_user_page (false);
-    if (page == NULL) return false;
-    pagedir_set_page (cur->pagedir, INCR_VADDR (addr, i), page, true);
-  }
-
-
-  /* TODO: multipage mmap writes */
-  /* TODO: possible circular dependency with syscall.c, also in write () below */
-  page = pagedir_get_page (cur->pagedir, addr);
-
-  /* use this later */
-  // unsigned file_seek = tell (fd);
-  int bytes_read = read (fd, addr, filesize);
-  if (bytes_read != filesize) {
-    // do something
+    if (is_used_vaddr (INCR_VADDR (addr, i))) return false;
   }
-  set_vaddr_map (mapping, MAP_USER_FILES, addr, filesize, fd);
 
-  /* mark page as not dirty */
-  for (int i = 0; i < pages; i++) {
-    pagedir_set_dirty (cur->pagedir, INCR_VADDR (addr, i), false);
-  }
-  return true;
+  set_vaddr_map (mapping, mtype, addr, filesize, fd);
+  return cur->vaddr_mappings[mapping] != NULL && cur->vaddr_mappings[mapping]->file != NULL;
 }
 
+/* removes the pages of MAPPING from the page directory, with their frames and swap slots, and frees the mapping
+ *   - write_back_to_file () must have saved the dirty pages first */
 void
 clear_vaddr_map_and_pte (mapid_t mapping)
 {
   struct thread *cur = thread_current ();
-  /* it's a thread method - TODO: place the methods as required */
   struct vaddr_map *vmap = cur->vaddr_mappings[mapping];
   int pages = get_pages_for_size (vmap->filesize);
-  for (int i = 0; i < pages; i++) {
-    pagedir_clear_page (cur->pagedir, INCR_VADDR (vmap->svaddr, i), false);
+
+  if (cur->pagedir != NULL) {
+    lock_frames ();
+    for (int i = 0; i < pages; i++) {
+      pagedir_free_page (cur->pagedir, INCR_VADDR (vmap->svaddr, i));
+    }
+    unlock_frames ();
   }
   free_vaddr_map (mapping);
 }
 
-/* merge with above method to avoid fetching the same variables */
+/* writes the dirty pages of MAPPING back to the file, each one to its own range only - a page evicted to swap was
+ *   dirty (clean ones are dropped), and is brought back in by the page fault handler as it's written out
+ * dirty pages are not written back to the file on eviction, as the faulting thread may hold buffer cache locks */
 void
 write_back_to_file (mapid_t mapping)
 {
   struct thread *cur = thread_current ();
   struct vaddr_map *vmap = cur->vaddr_mappings[mapping];
+  int pages = get_pages_for_size (vmap->filesize);
 
-  if (pagedir_is_dirty (cur->pagedir, vmap->svaddr)) {
-    /* TODO: handle multipage mmap writes */
-    void *page = pagedir_get_page (cur->pagedir, vmap->svaddr);
-    seek (vmap->fd, 0); /* TODO: should the seek be handled in read/write? */
+  if (cur->pagedir == NULL || vmap->file == NULL) return;
 
-    int bytes_written = write (vmap->fd, (const void *) vmap->svaddr, vmap->filesize);
-    if (bytes_written != vmap->filesize) {
-      // do something
-    }
-    seek (vmap->fd, 0);
+  for (int i = 0; i < pages; i++) {
+    void *upage = INCR_VADDR (vmap->svaddr, i);
+    uint32_t *pte = pagedir_get_pte (cur->pagedir, upage);
+    if (!pte_in_swap (pte) && !(pte_is_dirty (pte) && (*pte & PTE_P) != 0)) continue;
+
+    off_t ofs = i * PGSIZE;
+    off_t size = vmap->filesize - ofs < PGSIZE ? vmap->filesize - ofs : PGSIZE;
+    file_write_at (vmap->file, upage, size, ofs);
   }
 }
 
@@ -199,17 +244,275 @@ allocate_next_stack_page (void)
   return true;
 }
 
-void *
-bring_from_swap (pid_t pid, uint32_t *vaddr)
+/* returns the file mapping of T that VADDR lies in, or NULL */
+static struct vaddr_map *
+find_file_mapping (struct thread *t, void *vaddr)
+{
+  if (t == NULL || t->active_vaddr_maps == 0) return NULL;
+
+  for (int i = 0; i < MAX_VADDR_MAPS; i++) {
+    struct vaddr_map *vmap = t->vaddr_mappings[i];
+    if (vmap != NULL && vmap->mtype == MAP_USER_FILES && vmap->file != NULL
+        && vaddr >= (void *) vmap->svaddr && vaddr < (void *) vmap->evaddr)
+      return vmap;
+  }
+  return NULL;
+}
+
+static unsigned
+load_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct load_page *lp = hash_entry (e, struct load_page, elem);
+  return hash_bytes (&lp->upage, sizeof lp->upage);
+}
+
+static bool
+load_page_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  return hash_entry (a, struct load_page, elem)->upage < hash_entry (b, struct load_page, elem)->upage;
+}
+
+static void
+load_page_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct load_page, elem));
+}
+
+/* returns the load page of T that VADDR lies in, or NULL */
+static struct load_page *
+find_load_page (struct thread *t, void *vaddr)
 {
+  struct load_page key;
+
+  if (t == NULL || t->load_pages.buckets == NULL) return NULL;
+  key.upage = pg_round_down (vaddr);
+  struct hash_elem *e = hash_find (&t->load_pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct load_page, elem) : NULL;
+}
+
+bool
+init_load_pages (void)
+{
+  return hash_init (&thread_current ()->load_pages, load_page_hash, load_page_less, NULL);
+}
+
+/* records that UPAGE is to be filled with READ_BYTES from FILE at OFS, and zeroes after them, on first access */
+bool
+add_load_page (void *upage, struct file *file, off_t ofs, uint32_t read_bytes, bool writable)
+{
+  struct load_page *lp = malloc (sizeof *lp);
+  if (lp == NULL) return false;
+
+  lp->upage = upage;
+  lp->file = file;
+  lp->ofs = ofs;
+  lp->read_bytes = read_bytes;
+  lp->zero_bytes = PGSIZE - read_bytes;
+  lp->writable = writable;
+  /* segments overlapping in a page - the later one wins */
+  struct hash_elem *old = hash_replace (&thread_current ()->load_pages, &lp->elem);
+  if (old != NULL) load_page_free (old, NULL);
+  return true;
+}
+
+/* gives the running process, just forked, its own copy of the executable's page table of PARENT, reading from
+ *   FILE, its own handle on the executable */
+bool
+copy_load_pages (struct thread *parent, struct file *file)
+{
+  struct hash_iterator i;
+
+  if (!init_load_pages ()) return false;
+  hash_first (&i, &parent->load_pages);
+  while (hash_next (&i)) {
+    struct load_page *lp = hash_entry (hash_cur (&i), struct load_page, elem);
+    if (!add_load_page (lp->upage, file, lp->ofs, lp->read_bytes, lp->writable)) return false;
+  }
+  return true;
+}
+
+/* true if VADDR of T is a page of the executable that will be read in on access */
+bool
+is_load_vaddr (struct thread *t, void *vaddr)
+{
+  return find_load_page (t, vaddr) != NULL;
+}
+
+/* maps the text page LP of INODE from the shared text page cache - returns false if it isn't there */
+static bool
+share_text_page (struct load_page *lp, struct inode *inode)
+{
+  struct thread *cur = thread_current ();
+
+  lock_frames ();
+  void *kpage = find_text_page (inode, lp->ofs);
+  bool success = kpage != NULL && pagedir_set_page (cur->pagedir, lp->upage, kpage, false);
+  unlock_frames ();
+  return success;
+}
+
+/* reads in the page at VADDR from the executable on its first access, or after eviction dropped it
+ * a writable page goes to swap once it's been read in, so its entry is only used once */
+bool
+load_lazy_page (void *vaddr)
+{
+  struct thread *cur = thread_current ();
+  struct load_page *lp = find_load_page (cur, vaddr);
+  if (lp == NULL) return false;
+
+  /* read-only pages come from the shared text page cache, if another process running this program has them */
+  bool text = !lp->writable && lp->read_bytes > 0;
+  struct inode *inode = file_get_inode (lp->file);
+  if (text && share_text_page (lp, inode)) return true;
+
+  uint8_t *kpage = get_user_page (lp->read_bytes == 0);
+  if (kpage == NULL) return false;
+
+  if (lp->read_bytes > 0) {
+    if (file_read_at (lp->file, kpage, lp->read_bytes, lp->ofs) != (off_t) lp->read_bytes) {
+      free_user_page (kpage);
+      return false;
+    }
+    memset (kpage + lp->read_bytes, 0, lp->zero_bytes);
+  }
+
+  if (text) {
+    lock_frames ();
+    /* someone may have read the page in too, meanwhile */
+    void *shared = find_text_page (inode, lp->ofs);
+    bool success = shared != NULL ? pagedir_set_page (cur->pagedir, lp->upage, shared, false)
+                                  : pagedir_set_page (cur->pagedir, lp->upage, kpage, false);
+    if (success && shared == NULL) add_text_page (kpage, inode, lp->ofs);
+    unlock_frames ();
+    if (shared != NULL || !success) free_user_page (kpage);
+    return success;
+  }
+
+  if (!pagedir_set_page (cur->pagedir, lp->upage, kpage, lp->writable)) {
+    free_user_page (kpage);
+    return false;
+  }
+  return true;
+}
+
+/* releases the supplemental page table at process exit, after the page directory is gone */
+void
+free_load_pages (void)
+{
+  struct thread *cur = thread_current ();
+  if (cur->load_pages.buckets != NULL) hash_destroy (&cur->load_pages, load_page_free);
+  cur->load_pages.buckets = NULL;
+}
+
+/* true if page VADDR of T can be read back from a file, so that a clean copy needn't go to swap - read-only
+ *   pages of the executable and pages of an mmap'd file */
+bool
+is_file_backed_vaddr (struct thread *t, void *vaddr)
+{
+  struct load_page *lp = find_load_page (t, vaddr);
+  if (lp != NULL && !lp->writable) return true;
+  return find_file_mapping (t, vaddr) != NULL;
+}
+
+/* reads back the page at VADDR of an mmap'd file, after eviction dropped it */
+bool
+load_mapped_page (void *vaddr)
+{
+  struct thread *cur = thread_current ();
+  void *upage = pg_round_down (vaddr);
+  struct vaddr_map *vmap = find_file_mapping (cur, upage);
+  if (vmap == NULL) return false;
+
+  void *kpage = get_user_page (false);
+  if (kpage == NULL) return false;
+
+  off_t ofs = upage - (void *) vmap->svaddr;
+  off_t size = vmap->filesize - ofs < PGSIZE ? vmap->filesize - ofs : PGSIZE;
+  if (file_read_at (vmap->file, kpage, size, ofs) != size) {
+    free_user_page (kpage);
+    return false;
+  }
+  memset (kpage + size, 0, PGSIZE - size);
+
+  return pagedir_set_page (cur->pagedir, upage, kpage, true);
+}
+
+/* returns true if the page K pages away from UPAGE is swapped out to the slot K slots away from SLOT */
+static bool
+is_swap_neighbour (struct thread *t, uint8_t *upage, int slot, int k)
+{
+  uint8_t *vaddr = upage + k * PGSIZE;
+  if (k < 0 ? vaddr > upage || vaddr == NULL : vaddr < upage || !is_user_vaddr (vaddr)) return false;
+  if (slot + k < 0) return false;
+
+  uint32_t *pte = pagedir_get_pte (t->pagedir, vaddr);
+  return pte_in_swap (pte) && (int) pte_get_swap_slot (*pte) == slot + k;
+}
+
+/* brings the page at VADDR back from swap - the pages next to it that were swapped out to the adjacent slots
+ *   come along in the same transfer (fault-around), up to swap_cluster_size pages in all, as long as there are
+ *   free frames for them without evicting */
+bool
+bring_from_swap (uint32_t *vaddr)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *upage = pg_round_down (vaddr);
+  void *pages[SWAP_CLUSTER_MAX];
+  void *after[SWAP_CLUSTER_MAX], *before[SWAP_CLUSTER_MAX];
+  int after_cnt = 0, before_cnt = 0;
+
   void *kpage = get_user_page (false);
   if (kpage == NULL) {
     return false;
   }
 
-  if (get_from_swap (pid, (uint32_t *) pg_round_down (vaddr), kpage) == false) return false;
+  /* held until the pages are mapped: an eviction unmaps its victims into their slots before writing them out, so
+   *   with the lock held, every page found swapped out - the faulting one and its neighbours - is fully written */
+  lock_frames ();
+
+  uint32_t *pte = pagedir_get_pte (cur->pagedir, upage);
+  if (!pte_in_swap (pte)) {
+    unlock_frames ();
+    free_user_page (kpage);
+    return false;
+  }
+  int slot = pte_get_swap_slot (*pte);
+
+  /* pages after the faulting one first, as most accesses go upwards */
+  while ((size_t) (after_cnt + before_cnt + 1) < swap_cluster_size
+         && is_swap_neighbour (cur, upage, slot, after_cnt + 1)) {
+    void *page = palloc_get_page (PAL_USER);
+    if (page == NULL) break;
+    after[after_cnt++] = page;
+  }
+  while ((size_t) (after_cnt + before_cnt + 1) < swap_cluster_size
+         && is_swap_neighbour (cur, upage, slot, -(before_cnt + 1))) {
+    void *page = palloc_get_page (PAL_USER);
+    if (page == NULL) break;
+    before[before_cnt++] = page;
+  }
+
+  int cnt = 0;
+  for (int i = before_cnt - 1; i >= 0; i--) pages[cnt++] = before[i];
+  pages[cnt++] = kpage;
+  for (int i = 0; i < after_cnt; i++) pages[cnt++] = after[i];
+
+  read_from_swapslots (slot - before_cnt, cnt, pages);
 
-  pagedir_set_page (thread_current ()->pagedir, pg_round_down (vaddr), kpage, true);
+  for (int i = 0; i < cnt; i++) {
+    uint8_t *page_vaddr = upage + (i - before_cnt) * PGSIZE;
+    pte = pagedir_get_pte (cur->pagedir, page_vaddr);
+    bool writable = (*pte & PTE_W) != 0;
+
+    free_swapslot (slot - before_cnt + i);
+    pagedir_set_page (cur->pagedir, page_vaddr, pages[i], writable);
+    /* the slot was the only copy of the page, so it stays dirty - else a page of an mmap'd file would be
+     *   dropped as clean on its next eviction, and skipped by write_back_to_file () */
+    pagedir_set_dirty (cur->pagedir, page_vaddr, true);
+    if (i != before_cnt) set_frame_prefetched (pages[i]);
+  }
+  unlock_frames ();
+  check_free_frames ();
 
   return true;
 }
@@ -5,9 +5,23 @@
 #define MAX_STACK_PAGES 32
 #define INCR_VADDR(vaddr, i) (void *) vaddr + i * PGSIZE    /* increment as a 1-byte pointer instead of 4-byte uint32_t */
 
+#include <hash.h>
 #include <stdbool.h>
+#include "filesys/off_t.h"
 #include "threads/thread.h"
 
+/* supplemental page table entry: a page of a PT_LOAD segment, read from the executable (or zero-filled) on its
+ *   first access - entries stay until exit, as a read-only page can be dropped by eviction and read back again */
+struct load_page {
+  struct hash_elem elem;
+  void *upage;            // user page
+  struct file *file;      // executable
+  off_t ofs;              // offset of the page in file
+  uint32_t read_bytes;    // bytes read from file
+  uint32_t zero_bytes;    // bytes zeroed after them, PGSIZE - read_bytes
+  bool writable;
+};
+
 void * get_user_page (bool);
 void free_user_page (void *);
 bool is_stack_vaddr (void *);
@@ -15,7 +29,16 @@ bool write_file_to_vaddr (mapid_t, enum vaddr_map_type, uint32_t *, int, int);
 void write_back_to_file (mapid_t mapping);
 void clear_vaddr_map_and_pte (mapid_t mapping);
 
-void * bring_from_swap (pid_t, uint32_t *);
+bool bring_from_swap (uint32_t *);
+bool is_file_backed_vaddr (struct thread *, void *);
+bool is_load_vaddr (struct thread *, void *);
+bool init_load_pages (void);
+bool add_load_page (void *, struct file *, off_t, uint32_t, bool);
+bool copy_load_pages (struct thread *, struct file *);
+bool load_lazy_page (void *);
+void free_load_pages (void);
+bool load_mapped_page (void *);
+void free_vaddr_maps (void);
 
 bool allocate_next_stack_page (void);
 
@@ -24,5 +47,6 @@ bool is_mappable_vaddr (void *);
 mapid_t allocate_vaddr_mapid (void);
 void free_vaddr_map (mapid_t);
 void set_vaddr_map (mapid_t, enum vaddr_map_type, uint32_t *, int, int);
+bool copy_vaddr_maps (struct thread *);
 
 #endif /* vm/page.h */
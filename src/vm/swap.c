@@ -1,31 +1,60 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <bitmap.h>
 #include "vm/swap.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/synch.h"
 #include "devices/block.h"
+#include "devices/timer.h"
 
-/* NOTE: since swap tables must store virtual address which is process specific, it is not
- *   possible to have a direct mapping to some swap slot - however, an efficient alternative to
- *   linear search can be to hash to certain index based on the vaddr and then search linearly
- * NOTE: swap is a global datastore without a direct mapping, hence a lock is required (unlike fd or frame tables) */
+/* NOTE: a swapped out page keeps its slot number in the address bits of its (non-present) PTE,
+ *   next to PTE_S - so a page-in or process exit finds the slot straight from the PTE, without
+ *   any swap table lookup
+ * NOTE: swap is a global datastore, hence a lock is required for the slot bitmap (unlike fd or frame tables) */
 
 static struct block *swapblock;
-static uint32_t *swaplist;
+static struct bitmap *swapmap;      /* one bit per slot, true if in use */
 static size_t swap_sectors;
 static size_t swap_pages;
 static size_t sectors_per_page;
 static size_t allocated_slots;
 static struct lock swaplock;
 
+/* pages read around a faulting page with one transfer, at most - set by the -swapcluster kernel option */
+size_t swap_cluster_size = SWAP_CLUSTER_DEFAULT;
+
+/* clusters are read here and copied out to their frames, under prefetch_lock */
+static uint8_t *prefetch_buffer;
+static struct lock prefetch_lock;
+
+/* prefetched pages, and how many of them were accessed before being evicted or freed */
+static unsigned long long prefetched_cnt;
+static unsigned long long prefetch_used_cnt;
+static unsigned long long prefetch_wasted_cnt;
+
+/* pages moved to and from swap, and the time spent waiting for those transfers - the throughput of swap I/O, to
+ *   compare the IDE driver's DMA and PIO (-pio) paths */
+static unsigned long long pages_written;
+static unsigned long long pages_read;
+static int64_t io_ns;
+
+static void count_io (unsigned long long *, size_t, int64_t);
+
 /* if block is larger than page, then 1 page/block 
  * if pagesize % blocksize = 0 , then no wasted space
  * else, wasted space per page, and possibly at the end of swap */
 void
 init_swap_table (void)
 {
+  lock_init (&swaplock);
+  lock_init (&prefetch_lock);
+  if (swap_cluster_size < 1) swap_cluster_size = 1;
+  if (swap_cluster_size > SWAP_CLUSTER_MAX) swap_cluster_size = SWAP_CLUSTER_MAX;
   swapblock = block_get_role (BLOCK_SWAP);
   if (swapblock == NULL) {
     printf("No swap device: panic?\n");
@@ -42,9 +71,13 @@ init_swap_table (void)
     swap_pages = swap_sectors/sectors_per_page;
   }
 
+  /* the slot has to fit in the 20 address bits of a PTE */
+  if (swap_pages > PTE_ADDR >> PGBITS) swap_pages = PTE_ADDR >> PGBITS;
+
   printf ("Swap sectors are: %d, pages allowed in swap: %d\n", swap_sectors, swap_pages);
-  swaplist = malloc (swap_pages * sizeof (struct swap));
-  lock_init (&swaplock);
+  swapmap = bitmap_create (swap_pages);
+  if (swapmap == NULL) PANIC ("swap bitmap creation failed");
+  prefetch_buffer = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER_MAX);
 }
 
 /* assumes an unchangeable swap */
@@ -54,96 +87,124 @@ slot_to_sector (int slot)
   return (slot * sectors_per_page);
 }
 
-int
-find_in_swap (pid_t pid, uint32_t *vaddr)
+/* reads the CNT adjacent slots starting at SLOT with one transfer, page i going to PAGES[i] - the slots stay
+ *   allocated */
+void
+read_from_swapslots (int slot, size_t cnt, void **pages)
 {
-  struct swap *nswap;
-  int slot = -1;
-  bool found;
-
-  for (int i = 0; i < swap_pages; i++) {
-    nswap = *(swaplist + i);
-    if (nswap->pid == pid && nswap->vaddr == vaddr) {
-      slot = i;
-      break;
-    }
+  size_t start_sector = slot_to_sector (slot);
+
+  ASSERT (cnt <= SWAP_CLUSTER_MAX);
+  int64_t start = timer_nanoseconds ();
+  if (cnt == 1) {
+    block_read_multiple (swapblock, start_sector, sectors_per_page, pages[0]);
+    count_io (&pages_read, 1, start);
+    return;
   }
 
-  return slot;
+  lock_acquire (&prefetch_lock);
+  block_read_multiple (swapblock, start_sector, cnt * sectors_per_page, prefetch_buffer);
+  count_io (&pages_read, cnt, start);
+  for (size_t i = 0; i < cnt; i++) memcpy (pages[i], prefetch_buffer + i * PGSIZE, PGSIZE);
+  prefetched_cnt += cnt - 1;
+  lock_release (&prefetch_lock);
 }
 
-bool
-get_from_swap (pid_t pid, uint32_t *vaddr, void *buffer)
+/* counts a prefetched page as used, if it was accessed while in memory, or else as wasted */
+void
+swap_prefetch_done (bool used)
 {
-  int slot = find_in_swap (pid, vaddr);
-  if (slot == -1) return false;
-
-  size_t start_sector = slot_to_sector (slot);
-  int counter = 0; 
-  /* starts reading page from swap sector, write it to vaddr */
-  // TODO: allocate vaddr with lock
-  for (int i = start_sector; i < start_sector + sectors_per_page; i++) {
-    block_read (swapblock, i, buffer + counter * BLOCK_SECTOR_SIZE);
-  }
-
-  /* cleanup swapslot */
-  free_swapslot (slot);
+  if (used) prefetch_used_cnt++;
+  else prefetch_wasted_cnt++;
+}
 
-  return true;
+void
+swap_print_stats (void)
+{
+  if (swapblock == NULL) return;
+  printf ("Swap: %llu pages prefetched, %llu used, %llu wasted\n",
+          prefetched_cnt, prefetch_used_cnt, prefetch_wasted_cnt);
+
+  /* bytes per second of I/O time, in kB */
+  unsigned long long kbytes = (pages_written + pages_read) * (PGSIZE / 1024);
+  int64_t ms = io_ns / 1000000;
+  printf ("Swap: %llu pages written, %llu read in %lld ms of I/O, %llu kB/s\n",
+          pages_written, pages_read, ms, ms > 0 ? kbytes * 1000 / ms : 0);
 }
 
 int
 get_swapslot (void)
 {
-  if (allocated_slots >= swap_pages) {
+  size_t cnt = 1;
+  int slot = get_swapslots (&cnt);
+
+  if (slot == -1) {
     /* TODO: cause a page fault */
     printf("swapblock is full\n");
-    return -1;
   }
+  return slot;
+}
 
-  int slot = -1;
+/* allocates up to *CNT adjacent slots, halving the run until one fits, and returns the first - *CNT is set to
+ *   the number allocated, which is 0 (and the return value -1) if swap is full */
+int
+get_swapslots (size_t *cnt)
+{
+  size_t slot = BITMAP_ERROR;
 
-  lock_acquire (&swaplock);
-  for (int i = 0; i < swap_pages; i++) {
-    if (*(swaplist + i) == 0) {
-      allocated_slots++;
-      slot = i;
-      break;
+  if (swapmap != NULL) {
+    lock_acquire (&swaplock);
+    for (; *cnt > 0; *cnt /= 2) {
+      slot = bitmap_scan_and_flip (swapmap, 0, *cnt, false);
+      if (slot != BITMAP_ERROR) break;
     }
+    if (slot != BITMAP_ERROR) allocated_slots += *cnt;
+    lock_release (&swaplock);
   }
 
-  lock_release (&swaplock);
+  if (slot == BITMAP_ERROR) {
+    *cnt = 0;
+    return -1;
+  }
   return slot;
 }
 
-/* no lock is required */
 void
 free_swapslot (int slot)
 {
-  struct swap *nswap = *(swaplist + slot);
-  *(swaplist + slot) = 0;
+  lock_acquire (&swaplock);
+  ASSERT (bitmap_test (swapmap, slot));
+  bitmap_reset (swapmap, slot);
   allocated_slots--;
-  free (nswap);
+  lock_release (&swaplock);
 }
 
+/* writes the user page at kernel address KPAGE to SLOT - its PTE must already point to the slot */
 void
-map_and_write_to_swapslot (int slot, pid_t pid, uint32_t *vaddr)
+write_to_swapslot (int slot, void *kpage)
 {
-  // printf("mapping and write to swapslot: %d, pid: %d, addr: %p\n", slot, pid, vaddr);
-  struct swap *nswap = malloc (sizeof (struct swap));
-  nswap->pid = pid;
-  nswap->vaddr = vaddr;
-  *(swaplist + slot) = nswap;
+  write_to_swapslots (slot, 1, kpage);
+}
 
+/* writes CNT pages from BUFFER to the adjacent slots starting at SLOT, with one transfer */
+void
+write_to_swapslots (int slot, size_t cnt, void *buffer)
+{
   size_t start_sector = slot_to_sector (slot);
-  int counter = 0;
 
-  struct thread *t = get_thread_by_pid (pid);
-  void *page = pagedir_get_page (t->pagedir, vaddr);
+  /* page 0 goes to sectors 0..7, page 1 to sectors 8..15, etc */
+  int64_t start = timer_nanoseconds ();
+  block_write_multiple (swapblock, start_sector, cnt * sectors_per_page, buffer);
+  count_io (&pages_written, cnt, start);
+}
 
-  for (int i = start_sector; i < start_sector + sectors_per_page; i++) {
-    /* write vaddr to sector 0 (for 512 bytes), vaddr + 512 to sector 1, etc*/
-    block_write (swapblock, i, page + counter * BLOCK_SECTOR_SIZE);
-    counter += 1;
-  }
+/* adds CNT pages to *PAGES, and the time since START to the time spent in swap I/O */
+static void
+count_io (unsigned long long *pages, size_t cnt, int64_t start)
+{
+  int64_t elapsed = timer_nanoseconds () - start;
+  enum intr_level old_level = intr_disable ();
+  *pages += cnt;
+  io_ns += elapsed;
+  intr_set_level (old_level);
 }
@@ -3,15 +3,22 @@
 
 #include "threads/thread.h"
 
-/* each swap is for 1 page = (PGSIZE/BLOCK_SECTOR_SIZE) sectors */
-struct swap {
-  int pid;
-  uint32_t *vaddr;
-};
+/* each swap slot is for 1 page = (PGSIZE/BLOCK_SECTOR_SIZE) sectors - the slot of a swapped out
+ *   page is kept in its PTE, see pte_get_swap_slot */
+
+/* fault-around on swap-in: default and most pages per cluster */
+#define SWAP_CLUSTER_DEFAULT 8
+#define SWAP_CLUSTER_MAX 16
+
+extern size_t swap_cluster_size;
 
 void init_swap_table (void);
 int get_swapslot (void);
-bool get_from_swap (pid_t, uint32_t *, void *);
-int find_in_swap (pid_t, uint32_t *);
-void map_and_write_to_swapslot (int, pid_t, uint32_t *);
+int get_swapslots (size_t *);
+void free_swapslot (int);
+void write_to_swapslot (int, void *);
+void write_to_swapslots (int, size_t, void *);
+void read_from_swapslots (int, size_t, void **);
+void swap_prefetch_done (bool);
+void swap_print_stats (void);
 #endif /* vm/swap.h */